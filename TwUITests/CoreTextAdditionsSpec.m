@@ -0,0 +1,286 @@
+//
+//  CoreTextAdditionsSpec.m
+//  TwUITests
+//
+
+#import <TwUI/TUIKit.h>
+
+// The line metrics functions look lines up by binary search. These are the
+// linear scans they replaced, kept here to check the results didn't change.
+
+static void LegacyLineHeight(CTLineRef line, CGPoint *lineOrigins, CFIndex i, CFIndex linesCount, CGRect bounds, CGFloat *lineHeight, CGFloat *line_y)
+{
+	CGFloat ascent, descent, leading;
+	CTLineGetTypographicBounds(line, &ascent, &descent, &leading);
+	CGPoint lineOrigin = lineOrigins[i];
+	BOOL useRealHeight = i < linesCount - 1;
+	CGFloat neighborLineY = i > 0 ? lineOrigins[i - 1].y : (useRealHeight ? lineOrigins[i + 1].y : 0.0f);
+	*lineHeight = ceil(useRealHeight ? fabs(neighborLineY - lineOrigin.y) : ascent + descent + leading);
+	*line_y = round(useRealHeight ? lineOrigin.y + bounds.origin.y - *lineHeight/2 + descent : lineOrigin.y - descent + bounds.origin.y);
+}
+
+static BOOL LegacyRangeContainsIndex(CFRange range, CFIndex index)
+{
+	return index >= range.location && index <= range.location + range.length;
+}
+
+static NSArray *LegacyRectsForRange(CTFrameRef frame, CFRange range, AB_CTLineRectAggregationType aggregationType)
+{
+	CGRect bounds;
+	CGPathIsRect(CTFrameGetPath(frame), &bounds);
+	NSArray *lines = (__bridge NSArray *)CTFrameGetLines(frame);
+	CFIndex linesCount = [lines count];
+	CGPoint lineOrigins[linesCount];
+	CTFrameGetLineOrigins(frame, CFRangeMake(0, linesCount), lineOrigins);
+
+	NSMutableArray *rects = [NSMutableArray array];
+	CFIndex startIndex = range.location;
+	CFIndex endIndex = startIndex + range.length;
+
+	for(CFIndex i = 0; i < linesCount; ++i) {
+		CTLineRef line = (__bridge CTLineRef)[lines objectAtIndex:i];
+		CFRange lineRange = CTLineGetStringRange(line);
+		BOOL containsStartIndex = LegacyRangeContainsIndex(lineRange, startIndex);
+		BOOL containsEndIndex = LegacyRangeContainsIndex(lineRange, endIndex);
+		CGFloat x = bounds.origin.x + lineOrigins[i].x;
+		CGFloat lineHeight, line_y;
+		LegacyLineHeight(line, lineOrigins, i, linesCount, bounds, &lineHeight, &line_y);
+
+		if(containsStartIndex && containsEndIndex) {
+			CGFloat startOffset = CTLineGetOffsetForStringIndex(line, startIndex, NULL);
+			CGFloat endOffset = CTLineGetOffsetForStringIndex(line, endIndex, NULL);
+			CGRect r = CGRectMake(x + startOffset, line_y, endOffset - startOffset, lineHeight);
+			if(aggregationType == AB_CTLineRectAggregationTypeBlock)
+				r.size.width = bounds.size.width - startOffset;
+			[rects addObject:[NSValue valueWithRect:r]];
+			break;
+		} else if(containsStartIndex) {
+			if(startIndex == lineRange.location + lineRange.length)
+				continue;
+			CGFloat startOffset = CTLineGetOffsetForStringIndex(line, startIndex, NULL);
+			[rects addObject:[NSValue valueWithRect:CGRectMake(x + startOffset, line_y, bounds.size.width - startOffset, lineHeight)]];
+		} else if(containsEndIndex) {
+			CGFloat endOffset = CTLineGetOffsetForStringIndex(line, endIndex, NULL);
+			CGRect r = CGRectMake(x, line_y, endOffset, lineHeight);
+			if(aggregationType == AB_CTLineRectAggregationTypeBlock)
+				r.size.width = bounds.size.width;
+			[rects addObject:[NSValue valueWithRect:r]];
+		} else if(LegacyRangeContainsIndex(range, lineRange.location)) {
+			[rects addObject:[NSValue valueWithRect:CGRectMake(x, line_y, bounds.size.width, lineHeight)]];
+		}
+	}
+	return rects;
+}
+
+static CFIndex LegacyStringIndexForPosition(CTFrameRef frame, CGPoint p)
+{
+	NSArray *lines = (__bridge NSArray *)CTFrameGetLines(frame);
+	CFIndex linesCount = [lines count];
+	CGPoint lineOrigins[linesCount];
+	CTFrameGetLineOrigins(frame, CFRangeMake(0, linesCount), lineOrigins);
+
+	for(CFIndex i = 0; i < linesCount; ++i) {
+		CTLineRef line = (__bridge CTLineRef)[lines objectAtIndex:i];
+		CGFloat ascent, descent;
+		CTLineGetTypographicBounds(line, &ascent, &descent, NULL);
+		if(p.y > (floor(lineOrigins[i].y) - floor(descent))) { // above bottom of line
+			if(i == 0 && (p.y > (ceil(lineOrigins[i].y) + ceil(ascent)))) // above top of first line
+				return 0;
+			return CTLineGetStringIndexForPosition(line, CGPointMake(p.x - lineOrigins[i].x, p.y - lineOrigins[i].y));
+		}
+	}
+	return CTFrameGetStringRange(frame).length;
+}
+
+static void LegacyLinePositionOfIndex(CTFrameRef frame, CFIndex index, CFIndex *lineIndex, float *xPosition)
+{
+	// counts glyphs rather than characters, which only agree when no glyph stands for several characters
+	NSArray *lines = (__bridge NSArray *)CTFrameGetLines(frame);
+	CFIndex linesCount = [lines count];
+	CFIndex charCount = 0;
+
+	for(CFIndex i = 0; i < linesCount; ++i) {
+		CTLineRef line = (__bridge CTLineRef)[lines objectAtIndex:i];
+		CFIndex count = CTLineGetGlyphCount(line);
+		if((index >= charCount && index < charCount + count) || i == linesCount - 1) {
+			*lineIndex = i;
+			*xPosition = CTLineGetOffsetForStringIndex(line, index, NULL);
+			return;
+		}
+		charCount += count;
+	}
+	*lineIndex = -1;
+	*xPosition = 0;
+}
+
+static NSArray *MetricsRectsForRange(AB_CTFrameMetricsRef metrics, CFRange range, AB_CTLineRectAggregationType aggregationType)
+{
+	NSMutableArray *rects = [NSMutableArray array];
+	AB_CTFrameMetricsEnumerateRectsForRange(metrics, range, aggregationType, ^(CGRect rect, BOOL *stop) {
+		[rects addObject:[NSValue valueWithRect:rect]];
+	});
+	return rects;
+}
+
+static CTFrameRef CreateFrame(NSString *string, NSString *fontName, CGRect rect)
+{
+	CTFontRef font = CTFontCreateWithName((__bridge CFStringRef)fontName, 14, NULL);
+	NSAttributedString *attributedString = [[NSAttributedString alloc] initWithString:string attributes:@{ (NSString *)kCTFontAttributeName: (__bridge id)font }];
+	CFRelease(font);
+
+	CTFramesetterRef framesetter = CTFramesetterCreateWithAttributedString((__bridge CFAttributedStringRef)attributedString);
+	CGPathRef path = CGPathCreateWithRect(rect, NULL);
+	CTFrameRef frame = CTFramesetterCreateFrame(framesetter, CFRangeMake(0, 0), path, NULL);
+	CGPathRelease(path);
+	CFRelease(framesetter);
+	return frame;
+}
+
+SpecBegin(CoreTextAdditions)
+
+// an origin off zero, so rects have to be offset into the path
+CGRect bounds = CGRectMake(10, 20, 120, 400);
+
+__block CTFrameRef frame;
+__block AB_CTFrameMetricsRef metrics;
+__block NSArray *lines;
+
+afterEach(^{
+	AB_CTFrameMetricsRelease(metrics);
+	metrics = NULL;
+	if(frame) CFRelease(frame);
+	frame = NULL;
+	lines = nil;
+});
+
+describe(@"a frame of several lines", ^{
+	beforeEach(^{
+		frame = CreateFrame(@"The quick brown cat jumps over the lazy dog, then naps by the warm stove and dreams about mice.", @"Helvetica", bounds);
+		metrics = AB_CTFrameMetricsCreate(frame);
+		lines = (__bridge NSArray *)CTFrameGetLines(frame);
+	});
+
+	it(@"should be laid out in more than two lines", ^{
+		expect(lines.count).to.beGreaterThan(2);
+	});
+
+	it(@"should find the same rects for ranges starting or ending at a line boundary", ^{
+		for(AB_CTLineRectAggregationType type = AB_CTLineRectAggregationTypeInline; type <= AB_CTLineRectAggregationTypeBlock; type++) {
+			for(NSUInteger i = 1; i < lines.count; i++) {
+				CFIndex boundary = CTLineGetStringRange((__bridge CTLineRef)lines[i]).location;
+				CFRange ranges[] = {
+					CFRangeMake(boundary, 3), // starts a line
+					CFRangeMake(boundary - 3, 3), // ends a line
+					CFRangeMake(boundary - 3, 6), // crosses a line break
+					CFRangeMake(boundary, 0), // caret at the start of a line, or the end of the one above
+					CFRangeMake(0, boundary), // every line above
+				};
+				for(NSUInteger r = 0; r < sizeof(ranges) / sizeof(ranges[0]); r++) {
+					expect(MetricsRectsForRange(metrics, ranges[r], type)).to.equal(LegacyRectsForRange(frame, ranges[r], type));
+				}
+			}
+		}
+	});
+
+	it(@"should find the same rect for a caret at the end of each line", ^{
+		for(id line in lines) {
+			CFRange lineRange = CTLineGetStringRange((__bridge CTLineRef)line);
+			CFRange caret = CFRangeMake(lineRange.location + lineRange.length, 0);
+			expect(MetricsRectsForRange(metrics, caret, AB_CTLineRectAggregationTypeInline)).to.equal(LegacyRectsForRange(frame, caret, AB_CTLineRectAggregationTypeInline));
+		}
+	});
+
+	it(@"should find the same line and offset for every index", ^{
+		CFIndex length = CTFrameGetStringRange(frame).length;
+		for(CFIndex index = 0; index <= length; index++) {
+			CFIndex lineIndex, legacyLineIndex;
+			float x, legacyX;
+			AB_CTFrameMetricsGetLinePositionOfIndex(metrics, index, &lineIndex, &x);
+			LegacyLinePositionOfIndex(frame, index, &legacyLineIndex, &legacyX);
+			expect(lineIndex).to.equal(legacyLineIndex);
+			expect(x).to.equal(legacyX);
+		}
+	});
+
+	it(@"should only extend Block rects to the edge of the path", ^{
+		CFIndex secondLine = CTLineGetStringRange((__bridge CTLineRef)lines[1]).location;
+		CFRange range = CFRangeMake(2, secondLine); // from the first line into the second
+
+		NSArray *inlineRects = MetricsRectsForRange(metrics, range, AB_CTLineRectAggregationTypeInline);
+		NSArray *blockRects = MetricsRectsForRange(metrics, range, AB_CTLineRectAggregationTypeBlock);
+		expect(inlineRects.count).to.equal(2);
+		expect(blockRects.count).to.equal(2);
+
+		// the first line runs to the edge either way, the last only when aggregated as a block
+		expect(CGRectGetMaxX([inlineRects[0] rectValue])).to.equal(CGRectGetMaxX(bounds));
+		expect(CGRectGetMaxX([blockRects[0] rectValue])).to.equal(CGRectGetMaxX(bounds));
+		expect(CGRectGetMaxX([inlineRects[1] rectValue])).to.beLessThan(CGRectGetMaxX(bounds));
+		expect(CGRectGetMaxX([blockRects[1] rectValue])).to.equal(CGRectGetMaxX(bounds));
+	});
+
+	it(@"should offset rects by the origin it's created with", ^{
+		AB_CTFrameMetricsRef moved = AB_CTFrameMetricsCreateWithOrigin(frame, CGPointMake(bounds.origin.x + 5, bounds.origin.y - 7));
+		CGRect rect = [MetricsRectsForRange(metrics, CFRangeMake(4, 5), AB_CTLineRectAggregationTypeInline)[0] rectValue];
+		CGRect movedRect = [MetricsRectsForRange(moved, CFRangeMake(4, 5), AB_CTLineRectAggregationTypeInline)[0] rectValue];
+		AB_CTFrameMetricsRelease(moved);
+		expect([NSValue valueWithRect:movedRect]).to.equal([NSValue valueWithRect:CGRectOffset(rect, 5, -7)]);
+	});
+});
+
+describe(@"a frame with ligatures", ^{
+	beforeEach(^{
+		frame = CreateFrame(@"Affluent firms find officially fine flowers, the fluffiest office floral fixtures fill five offices.", @"Hoefler Text", bounds);
+		metrics = AB_CTFrameMetricsCreate(frame);
+		lines = (__bridge NSArray *)CTFrameGetLines(frame);
+	});
+
+	it(@"should draw fewer glyphs than characters", ^{
+		CFIndex glyphs = 0;
+		for(id line in lines) glyphs += CTLineGetGlyphCount((__bridge CTLineRef)line);
+		expect(glyphs).to.beLessThan(CTFrameGetStringRange(frame).length);
+	});
+
+	it(@"should find the same index for points along each line", ^{
+		CGPoint lineOrigins[lines.count];
+		CTFrameGetLineOrigins(frame, CFRangeMake(0, lines.count), lineOrigins);
+		for(NSUInteger i = 0; i < lines.count; i++) {
+			for(CGFloat x = -5; x < bounds.size.width + 5; x += 2) {
+				for(CGFloat dy = -6; dy <= 12; dy += 6) {
+					CGPoint p = CGPointMake(x, lineOrigins[i].y + dy);
+					expect(AB_CTFrameMetricsGetStringIndexForPosition(metrics, p)).to.equal(LegacyStringIndexForPosition(frame, p));
+				}
+			}
+		}
+
+		CGPoint above = CGPointMake(10, bounds.size.height + 10);
+		CGPoint below = CGPointMake(10, -10);
+		expect(AB_CTFrameMetricsGetStringIndexForPosition(metrics, above)).to.equal(LegacyStringIndexForPosition(frame, above));
+		expect(AB_CTFrameMetricsGetStringIndexForPosition(metrics, below)).to.equal(LegacyStringIndexForPosition(frame, below));
+	});
+
+	it(@"should find the line containing an index by its characters, not its glyphs", ^{
+		// the legacy scan counted glyphs, so past a ligature it put line starts on the line above
+		CFIndex length = CTFrameGetStringRange(frame).length;
+		for(CFIndex index = 0; index < length; index++) {
+			CFIndex lineIndex;
+			float x;
+			AB_CTFrameMetricsGetLinePositionOfIndex(metrics, index, &lineIndex, &x);
+
+			CFRange lineRange = CTLineGetStringRange((__bridge CTLineRef)lines[lineIndex]);
+			expect(index).to.beGreaterThanOrEqualTo(lineRange.location);
+			expect(index).to.beLessThan(lineRange.location + lineRange.length);
+			expect(x).to.equal((float)CTLineGetOffsetForStringIndex((__bridge CTLineRef)lines[lineIndex], index, NULL));
+		}
+	});
+
+	it(@"should find the same rects as before", ^{
+		for(NSUInteger i = 1; i < lines.count; i++) {
+			CFIndex boundary = CTLineGetStringRange((__bridge CTLineRef)lines[i]).location;
+			CFRange range = CFRangeMake(boundary - 4, 8);
+			expect(MetricsRectsForRange(metrics, range, AB_CTLineRectAggregationTypeInline)).to.equal(LegacyRectsForRange(frame, range, AB_CTLineRectAggregationTypeInline));
+			expect(MetricsRectsForRange(metrics, range, AB_CTLineRectAggregationTypeBlock)).to.equal(LegacyRectsForRange(frame, range, AB_CTLineRectAggregationTypeBlock));
+		}
+	});
+});
+
+SpecEnd
@@ -0,0 +1,180 @@
+//
+//  TUIBenchmarkSpec.m
+//  TwUITests
+//
+
+#import <TwUI/TUIKit.h>
+
+// Benchmarks log the time their block takes per iteration instead of asserting
+// on it, as the numbers depend on the machine running them.
+static NSTimeInterval TUIBenchmark(NSString *name, NSUInteger iterations, void (^block)(NSUInteger iteration)) {
+	CFAbsoluteTime start = CFAbsoluteTimeGetCurrent();
+	for(NSUInteger i = 0; i < iterations; i++) {
+		@autoreleasepool {
+			block(i);
+		}
+	}
+	NSTimeInterval perIteration = (CFAbsoluteTimeGetCurrent() - start) / iterations;
+	NSLog(@"%@: %.2f µs", name, perIteration * 1e6);
+	return perIteration;
+}
+
+@interface TUIBenchmarkTableDataSource : NSObject <TUITableViewDataSource, TUITableViewDelegate>
+@property (nonatomic, assign) NSInteger numberOfRows;
+@end
+
+@implementation TUIBenchmarkTableDataSource
+
+- (NSInteger)tableView:(TUITableView *)table numberOfRowsInSection:(NSInteger)section {
+	return self.numberOfRows;
+}
+
+- (CGFloat)tableView:(TUITableView *)tableView heightForRowAtIndexPath:(NSIndexPath *)indexPath {
+	return 20 + indexPath.row % 3 * 10;
+}
+
+- (TUITableViewCell *)tableView:(TUITableView *)tableView cellForRowAtIndexPath:(NSIndexPath *)indexPath {
+	TUITableViewCell *cell = [tableView dequeueReusableCellWithIdentifier:@"cell"];
+	if (cell == nil) cell = [[TUITableViewCell alloc] initWithStyle:TUITableViewCellStyleDefault reuseIdentifier:@"cell"];
+	return cell;
+}
+
+@end
+
+// Fills its bounds with stripes, standing in for a view that redraws often.
+@interface TUIBenchmarkDrawingView : TUIView
+@end
+
+@implementation TUIBenchmarkDrawingView
+
+- (void)drawRect:(CGRect)rect {
+	CGContextRef context = TUIGraphicsGetCurrentContext();
+	for (CGFloat y = 0; y < CGRectGetHeight(self.bounds); y += 10) {
+		CGContextSetGrayFillColor(context, fmod(y, 20) ? 0.2 : 0.8, 1);
+		CGContextFillRect(context, CGRectMake(0, y, CGRectGetWidth(self.bounds), 10));
+	}
+}
+
+@end
+
+SpecBegin(TUIBenchmark)
+
+describe(@"table view", ^{
+	// Row lookups and scroll-time layout should cost about the same whatever
+	// the size of the table.
+	it(@"should look up and lay out rows in time independent of the row count", ^{
+		for (NSNumber *rowCount in @[ @1000, @100000, @1000000 ]) {
+			TUIBenchmarkTableDataSource *dataSource = [[TUIBenchmarkTableDataSource alloc] init];
+			dataSource.numberOfRows = rowCount.integerValue;
+
+			TUITableView *tableView = [[TUITableView alloc] initWithFrame:CGRectMake(0, 0, 300, 600) style:TUITableViewStylePlain];
+			tableView.dataSource = dataSource;
+			tableView.delegate = dataSource;
+			[tableView reloadData];
+
+			CGFloat contentHeight = tableView.contentSize.height;
+			TUIBenchmark([NSString stringWithFormat:@"indexPathsForRowsInRect: (%@ rows)", rowCount], 10000, ^(NSUInteger i) {
+				CGFloat y = (CGFloat)(i * 7919 % 10000) / 10000 * contentHeight;
+				[tableView indexPathsForRowsInRect:CGRectMake(0, y, 300, 600)];
+			});
+			TUIBenchmark([NSString stringWithFormat:@"indexPathForRowAtPoint: (%@ rows)", rowCount], 10000, ^(NSUInteger i) {
+				CGFloat y = (CGFloat)(i * 7919 % 10000) / 10000 * contentHeight;
+				[tableView indexPathForRowAtPoint:CGPointMake(10, y)];
+			});
+			TUIBenchmark([NSString stringWithFormat:@"scroll and layout (%@ rows)", rowCount], 1000, ^(NSUInteger i) {
+				NSInteger row = i * 7919 % rowCount.integerValue;
+				[tableView scrollToRowAtIndexPath:[NSIndexPath indexPathForRow:row inSection:0] atScrollPosition:TUITableViewScrollPositionToVisible animated:NO];
+				[tableView layoutSubviews];
+			});
+
+			tableView.dataSource = nil;
+			tableView.delegate = nil;
+		}
+	});
+});
+
+describe(@"hit testing", ^{
+	// Every view has the same children in a mix of z positions; the deep
+	// hierarchy nests them 50 levels down the last (frontmost) child.
+	TUIView *(^makeHierarchy)(NSUInteger, NSUInteger) = ^TUIView *(NSUInteger width, NSUInteger depth) {
+		TUIView *root = [[TUIView alloc] initWithFrame:CGRectMake(0, 0, 1000, 1000)];
+		TUIView *parent = root;
+		for (NSUInteger level = 0; level < depth; level++) {
+			TUIView *front = nil;
+			for (NSUInteger i = 0; i < width; i++) {
+				TUIView *view = [[TUIView alloc] initWithFrame:parent.bounds];
+				view.layer.zPosition = i % 7;
+				[parent addSubview:view];
+				if (front == nil || view.layer.zPosition >= front.layer.zPosition) front = view;
+			}
+			parent = front;
+		}
+		return root;
+	};
+
+	it(@"should not sort subviews on every mouse move", ^{
+		NSDictionary *hierarchies = @{ @"wide": makeHierarchy(1000, 1), @"deep": makeHierarchy(10, 50) };
+		[hierarchies enumerateKeysAndObjectsUsingBlock:^(NSString *name, TUIView *root, BOOL *stop) {
+			TUIBenchmark([NSString stringWithFormat:@"hitTest:withEvent: (%@)", name], 10000, ^(NSUInteger i) {
+				[root hitTest:CGPointMake(i % 1000, i * 7 % 1000) withEvent:nil];
+			});
+
+			// moving a subview forces the root to sort again, as every call used to
+			TUIView *first = root.subviews[0];
+			TUIBenchmark([NSString stringWithFormat:@"hitTest:withEvent: resorting the root (%@)", name], 10000, ^(NSUInteger i) {
+				first.layer.zPosition = i % 2 ? 0 : -1;
+				[root hitTest:CGPointMake(i % 1000, i * 7 % 1000) withEvent:nil];
+			});
+		}];
+	});
+});
+
+describe(@"view display", ^{
+	// The copying path is what -displayLayer: did before it shared the bitmap
+	// with the layer: snapshot the context into an NSImage, then draw over the
+	// context again, which makes Core Graphics copy the snapshot's pixels.
+	it(@"should not copy the backing bitmap on every redraw", ^{
+		TUIBenchmarkDrawingView *view = [[TUIBenchmarkDrawingView alloc] initWithFrame:CGRectMake(0, 0, 800, 600)];
+		TUIBenchmark(@"displayLayer: (800x600)", 500, ^(NSUInteger i) {
+			[view setNeedsDisplay];
+			[view displayLayer:view.layer];
+		});
+
+		CALayer *layer = [CALayer layer];
+		CGContextRef context = TUICreateGraphicsContextWithOptions(view.bounds.size, NO);
+		TUIBenchmark(@"draw and copy into an NSImage (800x600)", 500, ^(NSUInteger i) {
+			TUIGraphicsPushContext(context);
+			[view drawRect:view.bounds];
+			TUIGraphicsPopContext();
+			layer.contents = TUIGraphicsContextGetImage(context);
+		});
+		CGContextRelease(context);
+	});
+});
+
+describe(@"stretchable images", ^{
+	// Setting the cap insets drops the sliced parts, so the second run slices
+	// the image on every draw, as drawing it did before the parts were cached.
+	it(@"should slice the image once", ^{
+		TUIStretchableImage *image = [[TUIStretchableImage alloc] initWithSize:NSMakeSize(30, 30)];
+		[image lockFocus];
+		[[NSColor grayColor] set];
+		NSRectFill(NSMakeRect(0, 0, 30, 30));
+		[image unlockFocus];
+		image.tui_capInsets = TUIEdgeInsetsMake(10, 10, 10, 10);
+
+		CGContextRef context = TUICreateGraphicsContextWithOptions(CGSizeMake(200, 40), NO);
+		TUIGraphicsPushContext(context);
+		TUIBenchmark(@"TUIStretchableImage drawInRect: (200x40)", 10000, ^(NSUInteger i) {
+			[image drawInRect:NSMakeRect(0, 0, 200, 40) fromRect:NSZeroRect operation:NSCompositeSourceOver fraction:1];
+		});
+		TUIBenchmark(@"TUIStretchableImage drawInRect: slicing every draw (200x40)", 10000, ^(NSUInteger i) {
+			image.tui_capInsets = TUIEdgeInsetsMake(10, 10, 10, 10);
+			[image drawInRect:NSMakeRect(0, 0, 200, 40) fromRect:NSZeroRect operation:NSCompositeSourceOver fraction:1];
+		});
+		TUIGraphicsPopContext();
+		CGContextRelease(context);
+	});
+});
+
+SpecEnd
@@ -0,0 +1,259 @@
+//
+//  TUITableViewSpec.m
+//  TwUITests
+//
+
+#import <TwUI/TUIKit.h>
+
+// Each section is an array of row heights; heightRequests counts how often the
+// table asked for one.
+@interface TUITableViewSpecDataSource : NSObject <TUITableViewDataSource, TUITableViewDelegate>
+@property (nonatomic, strong) NSMutableArray *sections;
+@property (nonatomic, assign) NSUInteger heightRequests;
+@end
+
+@implementation TUITableViewSpecDataSource
+
+- (NSInteger)numberOfSectionsInTableView:(TUITableView *)tableView {
+	return self.sections.count;
+}
+
+- (NSInteger)tableView:(TUITableView *)table numberOfRowsInSection:(NSInteger)section {
+	return [self.sections[section] count];
+}
+
+- (CGFloat)tableView:(TUITableView *)tableView heightForRowAtIndexPath:(NSIndexPath *)indexPath {
+	self.heightRequests++;
+	return [self.sections[indexPath.section][indexPath.row] floatValue];
+}
+
+- (TUITableViewCell *)tableView:(TUITableView *)tableView cellForRowAtIndexPath:(NSIndexPath *)indexPath {
+	TUITableViewCell *cell = [tableView dequeueReusableCellWithIdentifier:@"cell"];
+	if (cell == nil) cell = [[TUITableViewCell alloc] initWithStyle:TUITableViewCellStyleDefault reuseIdentifier:@"cell"];
+	return cell;
+}
+
+@end
+
+static NSIndexPath *IndexPath(NSUInteger section, NSUInteger row) {
+	return [NSIndexPath indexPathForRow:row inSection:section];
+}
+
+SpecBegin(TUITableView)
+
+__block TUITableView *tableView;
+__block TUITableViewSpecDataSource *dataSource;
+
+// loads sections of 10 point high rows
+void (^loadTable)(NSArray *) = ^(NSArray *rowCounts) {
+	dataSource.sections = [NSMutableArray array];
+	for (NSNumber *rowCount in rowCounts) {
+		NSMutableArray *rows = [NSMutableArray array];
+		for (NSInteger row = 0; row < rowCount.integerValue; row++) [rows addObject:@10];
+		[dataSource.sections addObject:rows];
+	}
+	[tableView reloadData];
+};
+
+beforeEach(^{
+	dataSource = [[TUITableViewSpecDataSource alloc] init];
+	tableView = [[TUITableView alloc] initWithFrame:CGRectMake(0, 0, 100, 50) style:TUITableViewStylePlain];
+	tableView.dataSource = dataSource;
+	tableView.delegate = dataSource;
+});
+
+afterEach(^{
+	tableView.dataSource = nil;
+	tableView.delegate = nil;
+});
+
+describe(@"row lookup", ^{
+	// The table is laid out top to bottom from the top of the content, so with
+	// 10 rows of 10 points row 0 covers y 90-100 and row 9 covers y 0-10.
+	beforeEach(^{
+		loadTable(@[ @10 ]);
+	});
+
+	it(@"should find the row containing a point", ^{
+		expect([tableView indexPathForRowAtPoint:CGPointMake(5, 95)]).to.equal(IndexPath(0, 0));
+		expect([tableView indexPathForRowAtPoint:CGPointMake(5, 45)]).to.equal(IndexPath(0, 5));
+		expect([tableView indexPathForRowAtPoint:CGPointMake(5, 0)]).to.equal(IndexPath(0, 9));
+	});
+
+	it(@"should give a point on the edge between two rows to the row above", ^{
+		expect([tableView indexPathForRowAtPoint:CGPointMake(5, 90)]).to.equal(IndexPath(0, 0));
+		expect([tableView indexPathForRowAtPoint:CGPointMake(5, 10)]).to.equal(IndexPath(0, 8));
+	});
+
+	it(@"should give a vertical offset on the edge between two rows to the row above", ^{
+		expect([tableView indexPathForRowAtVerticalOffset:90]).to.equal(IndexPath(0, 0));
+		expect([tableView indexPathForRowAtVerticalOffset:50]).to.equal(IndexPath(0, 4));
+		expect([tableView indexPathForRowAtVerticalOffset:0]).to.equal(IndexPath(0, 9));
+	});
+
+	it(@"should find no row outside of the content", ^{
+		expect([tableView indexPathForRowAtPoint:CGPointMake(5, 100)]).to.beNil();
+		expect([tableView indexPathForRowAtPoint:CGPointMake(5, -1)]).to.beNil();
+		expect([tableView indexPathForRowAtVerticalOffset:101]).to.beNil();
+	});
+
+	it(@"should find the rows in a rect", ^{
+		NSArray *expected = @[ IndexPath(0, 3), IndexPath(0, 4), IndexPath(0, 5), IndexPath(0, 6) ];
+		expect([tableView indexPathsForRowsInRect:CGRectMake(0, 35, 100, 30)]).to.equal(expected);
+		expect([tableView indexPathsForRowsInRect:CGRectMake(0, 91, 100, 100)]).to.equal(@[ IndexPath(0, 0) ]);
+		expect([tableView indexPathsForRowsInRect:CGRectMake(0, 200, 100, 10)]).to.equal(@[]);
+	});
+});
+
+describe(@"row lookup with empty sections", ^{
+	// sections 0 and 2 are empty; section 1 covers y 30-50 and section 3 y 0-30
+	beforeEach(^{
+		loadTable(@[ @0, @2, @0, @3, @0 ]);
+	});
+
+	it(@"should skip empty sections", ^{
+		expect([tableView indexPathForRowAtPoint:CGPointMake(5, 45)]).to.equal(IndexPath(1, 0));
+		expect([tableView indexPathForRowAtPoint:CGPointMake(5, 25)]).to.equal(IndexPath(3, 0));
+		expect([tableView indexPathForRowAtPoint:CGPointMake(5, 5)]).to.equal(IndexPath(3, 2));
+	});
+
+	it(@"should give the edge next to an empty section to the row above", ^{
+		expect([tableView indexPathForRowAtVerticalOffset:30]).to.equal(IndexPath(1, 1));
+		expect([tableView indexPathForRowAtPoint:CGPointMake(5, 30)]).to.equal(IndexPath(1, 1));
+	});
+
+	it(@"should find rows across sections in a rect", ^{
+		NSArray *expected = @[ IndexPath(1, 1), IndexPath(3, 0) ];
+		expect([tableView indexPathsForRowsInRect:CGRectMake(0, 21, 100, 18)]).to.equal(expected);
+
+		NSIndexSet *sections = [tableView indexesOfSectionsInRect:CGRectMake(0, 21, 100, 18)];
+		expect([sections containsIndex:1]).to.beTruthy();
+		expect([sections containsIndex:3]).to.beTruthy();
+		expect([sections containsIndex:0]).to.beFalsy();
+		expect([sections containsIndex:4]).to.beFalsy();
+	});
+
+	it(@"should find no rows in a table of empty sections", ^{
+		loadTable(@[ @0, @0 ]);
+		expect([tableView indexPathForRowAtPoint:CGPointMake(5, 0)]).to.beNil();
+		expect([tableView indexPathForRowAtVerticalOffset:0]).to.beNil();
+		expect([tableView indexPathsForRowsInRect:CGRectMake(0, 0, 100, 50)]).to.equal(@[]);
+	});
+});
+
+describe(@"background row heights", ^{
+	it(@"should estimate rows from the first row when there is no estimated row height", ^{
+		tableView.backgroundRowHeightProvider = ^CGFloat (NSIndexPath *indexPath) {
+			return 10;
+		};
+		loadTable(@[ @1000 ]);
+
+		// only the rows near the visible area are measured up front
+		expect(dataSource.heightRequests).to.beLessThan(100);
+		expect(tableView.contentSize.height).to.equal(10000);
+		expect(CGRectGetHeight([tableView rectForRowAtIndexPath:IndexPath(0, 999)])).to.equal(10);
+	});
+});
+
+describe(@"batch row updates", ^{
+	// Rows are told apart by their heights. The update deletes the 11 point row,
+	// inserts a 15 point row at the top, moves the 13 point row to the top of
+	// section 1 and the 22 point row into section 0:
+	//
+	//   section 0: 10 11 12 13 14  ->  15 22 10 12 14
+	//   section 1: 20 21 22        ->  13 20 21
+	__block void (^applyUpdate)(void);
+
+	beforeEach(^{
+		// tall enough to show every row
+		tableView.frame = CGRectMake(0, 0, 100, 200);
+		dataSource.sections = [@[ [@[ @10, @11, @12, @13, @14 ] mutableCopy], [@[ @20, @21, @22 ] mutableCopy] ] mutableCopy];
+		[tableView reloadData];
+
+		applyUpdate = ^{
+			dataSource.sections = [@[ [@[ @15, @22, @10, @12, @14 ] mutableCopy], [@[ @13, @20, @21 ] mutableCopy] ] mutableCopy];
+			dataSource.heightRequests = 0;
+
+			[tableView beginUpdates];
+			[tableView deleteRowsAtIndexPaths:@[ IndexPath(0, 1) ]];
+			[tableView insertRowsAtIndexPaths:@[ IndexPath(0, 0) ]];
+			[tableView moveRowAtIndexPath:IndexPath(0, 3) toIndexPath:IndexPath(1, 0)];
+			[tableView moveRowAtIndexPath:IndexPath(1, 2) toIndexPath:IndexPath(0, 1)];
+			[tableView endUpdates];
+		};
+	});
+
+	it(@"should move row heights with their rows", ^{
+		applyUpdate();
+
+		expect([tableView numberOfRowsInSection:0]).to.equal(5);
+		expect([tableView numberOfRowsInSection:1]).to.equal(3);
+		expect(tableView.contentSize.height).to.equal(127);
+
+		CGRect previousRect = CGRectNull;
+		for (NSUInteger section = 0; section < dataSource.sections.count; section++) {
+			NSArray *rows = dataSource.sections[section];
+			for (NSUInteger row = 0; row < rows.count; row++) {
+				CGRect rect = [tableView rectForRowAtIndexPath:IndexPath(section, row)];
+				expect(CGRectGetHeight(rect)).to.equal([rows[row] floatValue]);
+				if (!CGRectIsNull(previousRect)) expect(CGRectGetMaxY(rect)).to.equal(CGRectGetMinY(previousRect));
+				previousRect = rect;
+			}
+		}
+	});
+
+	it(@"should only measure inserted rows", ^{
+		applyUpdate();
+		expect(dataSource.heightRequests).to.equal(1);
+	});
+
+	it(@"should keep the cells of surviving rows", ^{
+		TUITableViewCell *cell10 = [tableView cellForRowAtIndexPath:IndexPath(0, 0)];
+		TUITableViewCell *cell13 = [tableView cellForRowAtIndexPath:IndexPath(0, 3)];
+		TUITableViewCell *cell21 = [tableView cellForRowAtIndexPath:IndexPath(1, 1)];
+		TUITableViewCell *cell22 = [tableView cellForRowAtIndexPath:IndexPath(1, 2)];
+		expect(cell10).notTo.beNil();
+		expect(cell13).notTo.beNil();
+		expect(cell21).notTo.beNil();
+		expect(cell22).notTo.beNil();
+
+		applyUpdate();
+
+		expect([tableView cellForRowAtIndexPath:IndexPath(0, 2)]).to.beIdenticalTo(cell10);
+		expect([tableView cellForRowAtIndexPath:IndexPath(1, 0)]).to.beIdenticalTo(cell13);
+		expect([tableView cellForRowAtIndexPath:IndexPath(1, 2)]).to.beIdenticalTo(cell21);
+		expect([tableView cellForRowAtIndexPath:IndexPath(0, 1)]).to.beIdenticalTo(cell22);
+		expect([tableView indexPathForCell:cell22]).to.equal(IndexPath(0, 1));
+		expect(tableView.visibleCells.count).to.equal(8);
+	});
+
+	it(@"should keep the selection on a moved row", ^{
+		[tableView selectRowAtIndexPath:IndexPath(1, 2) animated:NO scrollPosition:TUITableViewScrollPositionNone];
+		applyUpdate();
+		expect([tableView indexPathForSelectedRow]).to.equal(IndexPath(0, 1));
+	});
+
+	it(@"should keep the selection on a row shifted by the update", ^{
+		[tableView selectRowAtIndexPath:IndexPath(0, 2) animated:NO scrollPosition:TUITableViewScrollPositionNone];
+		applyUpdate();
+		expect([tableView indexPathForSelectedRow]).to.equal(IndexPath(0, 3));
+	});
+
+	it(@"should apply a move outside of an update block", ^{
+		[tableView selectRowAtIndexPath:IndexPath(1, 1) animated:NO scrollPosition:TUITableViewScrollPositionNone];
+		dataSource.sections[1] = [@[ @21, @20, @22 ] mutableCopy];
+		[tableView moveRowAtIndexPath:IndexPath(1, 0) toIndexPath:IndexPath(1, 1)];
+
+		expect([tableView indexPathForSelectedRow]).to.equal(IndexPath(1, 0));
+		expect(CGRectGetHeight([tableView rectForRowAtIndexPath:IndexPath(1, 0)])).to.equal(21);
+		expect(CGRectGetHeight([tableView rectForRowAtIndexPath:IndexPath(1, 1)])).to.equal(20);
+	});
+
+	it(@"should clear the selection on a deleted row", ^{
+		[tableView selectRowAtIndexPath:IndexPath(0, 1) animated:NO scrollPosition:TUITableViewScrollPositionNone];
+		applyUpdate();
+		expect([tableView indexPathForSelectedRow]).to.beNil();
+	});
+});
+
+SpecEnd
@@ -35,3 +35,22 @@ extern void AB_CTFrameGetLinePositionOfIndex(NSString *string, CTFrameRef frame,
 extern void AB_CTFrameGetRectsForRange(CTFrameRef frame, CFRange range, CGRect rects[], CFIndex *rectCount);
 extern void AB_CTFrameGetRectsForRangeWithAggregationType(CTFrameRef frame, CFRange range, AB_CTLineRectAggregationType aggregationType, CGRect rects[], CFIndex *rectCount);
 extern void AB_CTLinesGetRectsForRangeWithAggregationType(NSArray *lines, CGPoint *lineOrigins, CGRect bounds, CFRange range, AB_CTLineRectAggregationType aggregationType, CGRect rects[], CFIndex *rectCount);
+
+// The AB_CTFrame functions above gather the frame's line metrics on every call.
+// When querying the same frame repeatedly (e.g. hit testing every mouse drag
+// event) create the metrics once and use these instead; they look lines up by
+// binary search and don't allocate.
+typedef const struct __AB_CTFrameMetrics *AB_CTFrameMetricsRef;
+
+extern AB_CTFrameMetricsRef AB_CTFrameMetricsCreate(CTFrameRef frame); // retains the frame
+extern AB_CTFrameMetricsRef AB_CTFrameMetricsCreateWithOrigin(CTFrameRef frame, CGPoint origin); // rects as if the frame's path rect were moved to origin
+extern void AB_CTFrameMetricsRelease(AB_CTFrameMetricsRef metrics);
+extern CFIndex AB_CTFrameMetricsGetStringIndexForPosition(AB_CTFrameMetricsRef metrics, CGPoint p);
+extern void AB_CTFrameMetricsGetLinePositionOfIndex(AB_CTFrameMetricsRef metrics, CFIndex index, CFIndex *lineIndex, float *xPosition);
+extern void AB_CTFrameMetricsGetRectsForRange(AB_CTFrameMetricsRef metrics, CFRange range, AB_CTLineRectAggregationType aggregationType, CGRect rects[], CFIndex *rectCount);
+
+// Unlike the functions taking a fixed size rects array, these hand back every
+// rect in the range: one line at a time to the block, or all of them in a
+// malloc'd array the caller frees (NULL if there are none).
+extern void AB_CTFrameMetricsEnumerateRectsForRange(AB_CTFrameMetricsRef metrics, CFRange range, AB_CTLineRectAggregationType aggregationType, void (^block)(CGRect rect, BOOL *stop));
+extern CGRect *AB_CTFrameMetricsCopyRectsForRange(AB_CTFrameMetricsRef metrics, CFRange range, AB_CTLineRectAggregationType aggregationType, CFIndex *rectCount);
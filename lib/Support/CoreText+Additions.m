@@ -86,53 +86,6 @@ CGFloat AB_CTFrameGetHeight(CTFrameRef f)
 	return 0.0;
 }
 
-CFIndex AB_CTFrameGetStringIndexForPosition(CTFrameRef frame, CGPoint p)
-{
-	NSArray *lines = (__bridge NSArray *)CTFrameGetLines(frame);
-	
-	CFIndex linesCount = [lines count];
-	CGPoint *lineOrigins = (CGPoint *) malloc(sizeof(CGPoint) * linesCount);
-	CTFrameGetLineOrigins(frame, CFRangeMake(0, linesCount), lineOrigins);
-	
-	CTLineRef line = NULL;
-	CGPoint lineOrigin = CGPointZero;
-	
-	for(CFIndex i = 0; i < linesCount; ++i) {
-		line = (__bridge CTLineRef)[lines objectAtIndex:i];
-		lineOrigin = lineOrigins[i];
-		CGFloat descent, ascent;
-		CTLineGetTypographicBounds(line, &ascent, &descent, NULL);
-		if(p.y > (floor(lineOrigin.y) - floor(descent))) { // above bottom of line
-			if(i == 0 && (p.y > (ceil(lineOrigin.y) + ceil(ascent)))) { // above top of first line
-				free(lineOrigins);
-				return 0;
-			} else {
-				goto found;
-			}
-		}
-	}
-	
-	free(lineOrigins);
-	
-	// didn't find a line, must be beneath the last line
-	return CTFrameGetStringRange(frame).length; // last character index
-
-found:
-
-	p.x -= lineOrigin.x;
-	p.y -= lineOrigin.y;
-	
-	if(line) {
-		CFIndex i = CTLineGetStringIndexForPosition(line, p);
-		free(lineOrigins);
-		return i;
-	}
-	
-	free(lineOrigins);
-	
-	return 0;
-}
-
 static inline BOOL RangeContainsIndex(CFRange range, CFIndex index)
 {
 	BOOL a = (index >= range.location);
@@ -153,148 +106,262 @@ void AB_CTFrameGetIndexForPositionInLine(NSString *string, CTFrameRef frame, CFI
 	}
 }
 
-void AB_CTFrameGetLinePositionOfIndex(NSString *string, CTFrameRef frame, CFIndex index, CFIndex *lineIndex, float *xPosition)
+/*
+ * Everything the hit-testing and rect helpers need to know about a frame's
+ * lines, gathered once so each query is a binary search over plain structs
+ * instead of a walk over the lines asking Core Text for their metrics.
+ */
+typedef struct {
+	CTLineRef line; // owned by the frame
+	CGPoint origin;
+	CGFloat ascent;
+	CGFloat descent;
+	CGFloat leading;
+	CFRange stringRange;
+} AB_CTLineMetrics;
+
+struct __AB_CTFrameMetrics {
+	CTFrameRef frame;
+	CGRect bounds;
+	CFIndex lineCount;
+	AB_CTLineMetrics lines[];
+};
+
+static void AB_CTLineMetricsFill(AB_CTLineMetrics *metrics, CTLineRef line, CGPoint origin)
+{
+	metrics->line = line;
+	metrics->origin = origin;
+	CTLineGetTypographicBounds(line, &metrics->ascent, &metrics->descent, &metrics->leading);
+	metrics->stringRange = CTLineGetStringRange(line);
+}
+
+AB_CTFrameMetricsRef AB_CTFrameMetricsCreate(CTFrameRef frame)
 {
 	NSArray *lines = (__bridge NSArray *)CTFrameGetLines(frame);
-	CFIndex linesCount = [lines count];
-	CFIndex charCount = 0;
-	CFIndex count = 0;
+	CFIndex lineCount = [lines count];
 	
-	for(CFIndex i = 0; i < linesCount; ++i) {
-		CTLineRef line = (__bridge CTLineRef)[lines objectAtIndex:i];
-		count = CTLineGetGlyphCount(line);
-		
-		if((index >= charCount && index < charCount + count) || i == linesCount - 1) {
-			CGFloat offset = CTLineGetOffsetForStringIndex(line, index, NULL);
-			*lineIndex = i;
-			*xPosition = offset;
-			return;
-		}
-		
-		charCount += count;
+	struct __AB_CTFrameMetrics *metrics = malloc(sizeof(struct __AB_CTFrameMetrics) + sizeof(AB_CTLineMetrics) * lineCount);
+	metrics->frame = (CTFrameRef)CFRetain(frame);
+	metrics->bounds = CGRectZero;
+	CGPathIsRect(CTFrameGetPath(frame), &metrics->bounds);
+	metrics->lineCount = lineCount;
+	
+	CGPoint *lineOrigins = (CGPoint *) malloc(sizeof(CGPoint) * MAX(lineCount, 1));
+	CTFrameGetLineOrigins(frame, CFRangeMake(0, lineCount), lineOrigins);
+	for(CFIndex i = 0; i < lineCount; ++i) {
+		AB_CTLineMetricsFill(&metrics->lines[i], (__bridge CTLineRef)[lines objectAtIndex:i], lineOrigins[i]);
 	}
+	free(lineOrigins);
 	
-	*lineIndex = -1;
-	*xPosition = 0;
+	return metrics;
 }
 
-void AB_CTFrameGetRectsForRange(CTFrameRef frame, CFRange range, CGRect rects[], CFIndex *rectCount)
+AB_CTFrameMetricsRef AB_CTFrameMetricsCreateWithOrigin(CTFrameRef frame, CGPoint origin)
 {
-	AB_CTFrameGetRectsForRangeWithAggregationType(frame, range, AB_CTLineRectAggregationTypeInline, rects, rectCount);
+	struct __AB_CTFrameMetrics *metrics = (struct __AB_CTFrameMetrics *)AB_CTFrameMetricsCreate(frame);
+	metrics->bounds.origin = origin;
+	return metrics;
 }
 
-void AB_CTFrameGetRectsForRangeWithAggregationType(CTFrameRef frame, CFRange range, AB_CTLineRectAggregationType aggregationType, CGRect rects[], CFIndex *rectCount)
+void AB_CTFrameMetricsRelease(AB_CTFrameMetricsRef metrics)
 {
-	CGRect bounds;
-	CGPathIsRect(CTFrameGetPath(frame), &bounds);
+	if(metrics) {
+		CFRelease(metrics->frame);
+		free((void *)metrics);
+	}
+}
+
+// index of the first line whose string range ends at or after index, lineCount if none
+static CFIndex AB_CTLineMetricsFirstLineEndingAtOrAfterIndex(const AB_CTLineMetrics *lines, CFIndex lineCount, CFIndex index)
+{
+	CFIndex low = 0;
+	CFIndex high = lineCount;
+	while(low < high) {
+		CFIndex mid = low + (high - low) / 2;
+		if(lines[mid].stringRange.location + lines[mid].stringRange.length >= index)
+			high = mid;
+		else
+			low = mid + 1;
+	}
+	return low;
+}
+
+CFIndex AB_CTFrameMetricsGetStringIndexForPosition(AB_CTFrameMetricsRef metrics, CGPoint p)
+{
+	const AB_CTLineMetrics *lines = metrics->lines;
 	
-	NSArray *lines = (__bridge NSArray *)CTFrameGetLines(frame);
-	CFIndex linesCount = [lines count];
-	CGPoint *lineOrigins = (CGPoint *) malloc(sizeof(CGPoint) * linesCount);
-	CTFrameGetLineOrigins(frame, CFRangeMake(0, linesCount), lineOrigins);
+	// lines run top to bottom, so find the first one whose bottom is below p
+	CFIndex low = 0;
+	CFIndex high = metrics->lineCount;
+	while(low < high) {
+		CFIndex mid = low + (high - low) / 2;
+		if(p.y > (floor(lines[mid].origin.y) - floor(lines[mid].descent))) // above bottom of line
+			high = mid;
+		else
+			low = mid + 1;
+	}
 	
-	AB_CTLinesGetRectsForRangeWithAggregationType(lines, lineOrigins, bounds, range, aggregationType, rects, rectCount);
-	free(lineOrigins);
+	if(low == metrics->lineCount) {
+		// didn't find a line, must be beneath the last line
+		return CTFrameGetStringRange(metrics->frame).length; // last character index
+	}
+	
+	const AB_CTLineMetrics *line = &lines[low];
+	if(low == 0 && (p.y > (ceil(line->origin.y) + ceil(line->ascent)))) { // above top of first line
+		return 0;
+	}
+	
+	p.x -= line->origin.x;
+	p.y -= line->origin.y;
+	return CTLineGetStringIndexForPosition(line->line, p);
 }
 
-void AB_CTLinesGetRectsForRangeWithAggregationType(NSArray *lines, CGPoint *lineOrigins, CGRect bounds, CFRange range, AB_CTLineRectAggregationType aggregationType, CGRect rects[], CFIndex *rectCount)
+void AB_CTFrameMetricsGetLinePositionOfIndex(AB_CTFrameMetricsRef metrics, CFIndex index, CFIndex *lineIndex, float *xPosition)
 {
-	CFIndex maxRects = *rectCount;
-	CFIndex rectIndex = 0;
+	if(!metrics || metrics->lineCount == 0) {
+		*lineIndex = -1;
+		*xPosition = 0;
+		return;
+	}
+	
+	// the line containing index, or the last line if it's past the end
+	CFIndex i = AB_CTLineMetricsFirstLineEndingAtOrAfterIndex(metrics->lines, metrics->lineCount, index + 1);
+	if(i == metrics->lineCount)
+		i = metrics->lineCount - 1;
 	
+	*lineIndex = i;
+	*xPosition = CTLineGetOffsetForStringIndex(metrics->lines[i].line, index, NULL);
+}
+
+static void AB_CTLineMetricsEnumerateRectsForRange(const AB_CTLineMetrics *lines, CFIndex linesCount, CGRect bounds, CFRange range, AB_CTLineRectAggregationType aggregationType, void (^block)(CGRect rect, BOOL *stop))
+{
 	CFIndex startIndex = range.location;
 	CFIndex endIndex = startIndex + range.length;
 	
-	CFIndex linesCount = [lines count];
-	
-	for(CFIndex i = 0; i < linesCount; ++i) {
-		CTLineRef line = (__bridge CTLineRef)[lines objectAtIndex:i];
+	// lines which end before the range starts can't contribute, so skip straight past them
+	for(CFIndex i = AB_CTLineMetricsFirstLineEndingAtOrAfterIndex(lines, linesCount, startIndex); i < linesCount; ++i) {
+		const AB_CTLineMetrics *line = &lines[i];
+		
+		CFRange lineRange = line->stringRange;
+		CFIndex lineEndIndex = lineRange.location + lineRange.length;
+		if(lineRange.location > endIndex)
+			break; // past the end of the range
 		
-		CFRange lineRange = CTLineGetStringRange(line);
-		CFIndex lineStartIndex = lineRange.location;
-		CFIndex lineEndIndex = lineStartIndex + lineRange.length;
 		BOOL containsStartIndex = RangeContainsIndex(lineRange, startIndex);
 		BOOL containsEndIndex = RangeContainsIndex(lineRange, endIndex);
+		if(containsStartIndex && !containsEndIndex && startIndex == lineEndIndex)
+			continue;
+		if(!containsStartIndex && !containsEndIndex && !RangeContainsIndex(range, lineRange.location))
+			continue;
 		
-		if(containsStartIndex && containsEndIndex) {
-			CGPoint lineOrigin = lineOrigins[i];
-			CGFloat ascent, descent, leading;
-			CGFloat lineWidth = CTLineGetTypographicBounds(line, &ascent, &descent, &leading);
-			lineWidth = lineWidth;
-			
-			// If we have more than 1 line, we want to find the real height of the line by measuring the distance between the current line and previous line. If it's only 1 line, then we'll guess the line's height.
-			BOOL useRealHeight = i < linesCount - 1;
-			CGFloat neighborLineY = i > 0 ? lineOrigins[i - 1].y : (linesCount - 1 > i ? lineOrigins[i + 1].y : 0.0f);
-			CGFloat lineHeight = ceil(useRealHeight ? fabs(neighborLineY - lineOrigin.y) : ascent + descent + leading);
-			CGFloat line_y = round(useRealHeight ? lineOrigin.y + bounds.origin.y - lineHeight/2 + descent : lineOrigin.y - descent + bounds.origin.y);
-			
-			CGFloat startOffset = CTLineGetOffsetForStringIndex(line, startIndex, NULL);
-			CGFloat endOffset = CTLineGetOffsetForStringIndex(line, endIndex, NULL);
-			CGRect r = CGRectMake(bounds.origin.x + lineOrigin.x + startOffset, line_y, endOffset - startOffset, lineHeight);
-			if(aggregationType == AB_CTLineRectAggregationTypeBlock) {
-				r.size.width = bounds.size.width - startOffset;
-			}
-			
-			if(rectIndex < maxRects)
-				rects[rectIndex++] = r;
-			goto end;
-		} else if(containsStartIndex) {
-			if(startIndex == lineEndIndex)
-				continue;
-			
-			CGPoint lineOrigin = lineOrigins[i];
-			CGFloat ascent, descent, leading;
-			CGFloat lineWidth = CTLineGetTypographicBounds(line, &ascent, &descent, &leading);
-			lineWidth = lineWidth;
-			
-			// If we have more than 1 line, we want to find the real height of the line by measuring the distance between the current line and previous line. If it's only 1 line, then we'll guess the line's height.
-			BOOL useRealHeight = i < linesCount - 1;
-			CGFloat neighborLineY = i > 0 ? lineOrigins[i - 1].y : (linesCount > i ? lineOrigins[i + 1].y : 0.0f);
-			CGFloat lineHeight = ceil(useRealHeight ? fabs(neighborLineY - lineOrigin.y) : ascent + descent + leading);
-			CGFloat line_y = round(useRealHeight ? lineOrigin.y + bounds.origin.y - lineHeight/2 + descent : lineOrigin.y - descent + bounds.origin.y);
-			
-			CGFloat startOffset = CTLineGetOffsetForStringIndex(line, startIndex, NULL);
-			CGRect r = CGRectMake(bounds.origin.x + lineOrigin.x + startOffset, line_y, bounds.size.width - startOffset, lineHeight);
-			if(rectIndex < maxRects)
-				rects[rectIndex++] = r;
-		} else if(containsEndIndex) {
-			CGPoint lineOrigin = lineOrigins[i];
-			CGFloat ascent, descent, leading;
-			CGFloat lineWidth = CTLineGetTypographicBounds(line, &ascent, &descent, &leading);
-			lineWidth = lineWidth;
-			
-			// If we have more than 1 line, we want to find the real height of the line by measuring the distance between the current line and previous line. If it's only 1 line, then we'll guess the line's height.
-			BOOL useRealHeight = i < linesCount - 1;
-			CGFloat neighborLineY = i > 0 ? lineOrigins[i - 1].y : (linesCount > i ? lineOrigins[i + 1].y : 0.0f);
-			CGFloat lineHeight = ceil(useRealHeight ? fabs(neighborLineY - lineOrigin.y) : ascent + descent + leading);
-			CGFloat line_y = round(useRealHeight ? lineOrigin.y + bounds.origin.y - lineHeight/2 + descent : lineOrigin.y - descent + bounds.origin.y);
-			
-			CGFloat endOffset = CTLineGetOffsetForStringIndex(line, endIndex, NULL);
-			CGRect r = CGRectMake(bounds.origin.x + lineOrigin.x, line_y, endOffset, lineHeight);
-			if(aggregationType == AB_CTLineRectAggregationTypeBlock) {
-				r.size.width = bounds.size.width;
+		// If we have more than 1 line, we want to find the real height of the line by measuring the distance between the current line and previous line. If it's only 1 line, then we'll guess the line's height.
+		BOOL useRealHeight = i < linesCount - 1;
+		CGFloat neighborLineY = i > 0 ? lines[i - 1].origin.y : (useRealHeight ? lines[i + 1].origin.y : 0.0f);
+		CGFloat lineHeight = ceil(useRealHeight ? fabs(neighborLineY - line->origin.y) : line->ascent + line->descent + line->leading);
+		CGFloat line_y = round(useRealHeight ? line->origin.y + bounds.origin.y - lineHeight/2 + line->descent : line->origin.y - line->descent + bounds.origin.y);
+		
+		CGRect r = CGRectMake(bounds.origin.x + line->origin.x, line_y, bounds.size.width, lineHeight);
+		if(containsStartIndex) {
+			CGFloat startOffset = CTLineGetOffsetForStringIndex(line->line, startIndex, NULL);
+			r.origin.x += startOffset;
+			r.size.width = bounds.size.width - startOffset;
+			if(containsEndIndex && aggregationType != AB_CTLineRectAggregationTypeBlock) {
+				r.size.width = CTLineGetOffsetForStringIndex(line->line, endIndex, NULL) - startOffset;
 			}
-			
-			if(rectIndex < maxRects)
-				rects[rectIndex++] = r;
-		} else if(RangeContainsIndex(range, lineRange.location)) {
-			CGPoint lineOrigin = lineOrigins[i];
-			CGFloat ascent, descent, leading;
-			CGFloat lineWidth = CTLineGetTypographicBounds(line, &ascent, &descent, &leading);
-			lineWidth = lineWidth;
-			
-			// If we have more than 1 line, we want to find the real height of the line by measuring the distance between the current line and previous line. If it's only 1 line, then we'll guess the line's height.
-			BOOL useRealHeight = i < linesCount - 1;
-			CGFloat neighborLineY = i > 0 ? lineOrigins[i - 1].y : (linesCount > i ? lineOrigins[i + 1].y : 0.0f);
-			CGFloat lineHeight = ceil(useRealHeight ? fabs(neighborLineY - lineOrigin.y) : ascent + descent + leading);
-			CGFloat line_y = round(useRealHeight ? lineOrigin.y + bounds.origin.y - lineHeight/2 + descent : lineOrigin.y - descent + bounds.origin.y);
-			
-			CGRect r = CGRectMake(bounds.origin.x + lineOrigin.x, line_y, bounds.size.width, lineHeight);
-			if(rectIndex < maxRects)
-				rects[rectIndex++] = r;
+		} else if(containsEndIndex && aggregationType != AB_CTLineRectAggregationTypeBlock) {
+			r.size.width = CTLineGetOffsetForStringIndex(line->line, endIndex, NULL);
 		}
+		
+		BOOL stop = NO;
+		block(r, &stop);
+		if(stop || (containsStartIndex && containsEndIndex))
+			break;
+	}
+}
+
+static void AB_CTLineMetricsGetRectsForRange(const AB_CTLineMetrics *lines, CFIndex linesCount, CGRect bounds, CFRange range, AB_CTLineRectAggregationType aggregationType, CGRect rects[], CFIndex *rectCount)
+{
+	CFIndex maxRects = *rectCount;
+	__block CFIndex rectIndex = 0;
+	
+	if(maxRects > 0) {
+		AB_CTLineMetricsEnumerateRectsForRange(lines, linesCount, bounds, range, aggregationType, ^(CGRect rect, BOOL *stop) {
+			rects[rectIndex++] = rect;
+			*stop = (rectIndex == maxRects);
+		});
 	}
 	
-end:
 	*rectCount = rectIndex;
 }
+
+void AB_CTFrameMetricsGetRectsForRange(AB_CTFrameMetricsRef metrics, CFRange range, AB_CTLineRectAggregationType aggregationType, CGRect rects[], CFIndex *rectCount)
+{
+	if(!metrics) {
+		*rectCount = 0;
+		return;
+	}
+	AB_CTLineMetricsGetRectsForRange(metrics->lines, metrics->lineCount, metrics->bounds, range, aggregationType, rects, rectCount);
+}
+
+void AB_CTFrameMetricsEnumerateRectsForRange(AB_CTFrameMetricsRef metrics, CFRange range, AB_CTLineRectAggregationType aggregationType, void (^block)(CGRect rect, BOOL *stop))
+{
+	if(metrics)
+		AB_CTLineMetricsEnumerateRectsForRange(metrics->lines, metrics->lineCount, metrics->bounds, range, aggregationType, block);
+}
+
+CGRect *AB_CTFrameMetricsCopyRectsForRange(AB_CTFrameMetricsRef metrics, CFRange range, AB_CTLineRectAggregationType aggregationType, CFIndex *rectCount)
+{
+	__block CGRect *rects = NULL;
+	__block CFIndex count = 0;
+	__block CFIndex capacity = 0;
+	
+	AB_CTFrameMetricsEnumerateRectsForRange(metrics, range, aggregationType, ^(CGRect rect, BOOL *stop) {
+		if(count == capacity) {
+			capacity = MAX(capacity * 2, 8);
+			rects = realloc(rects, sizeof(CGRect) * capacity);
+		}
+		rects[count++] = rect;
+	});
+	
+	*rectCount = count;
+	return rects;
+}
+
+CFIndex AB_CTFrameGetStringIndexForPosition(CTFrameRef frame, CGPoint p)
+{
+	AB_CTFrameMetricsRef metrics = AB_CTFrameMetricsCreate(frame);
+	CFIndex index = AB_CTFrameMetricsGetStringIndexForPosition(metrics, p);
+	AB_CTFrameMetricsRelease(metrics);
+	return index;
+}
+
+void AB_CTFrameGetLinePositionOfIndex(NSString *string, CTFrameRef frame, CFIndex index, CFIndex *lineIndex, float *xPosition)
+{
+	AB_CTFrameMetricsRef metrics = AB_CTFrameMetricsCreate(frame);
+	AB_CTFrameMetricsGetLinePositionOfIndex(metrics, index, lineIndex, xPosition);
+	AB_CTFrameMetricsRelease(metrics);
+}
+
+void AB_CTFrameGetRectsForRange(CTFrameRef frame, CFRange range, CGRect rects[], CFIndex *rectCount)
+{
+	AB_CTFrameGetRectsForRangeWithAggregationType(frame, range, AB_CTLineRectAggregationTypeInline, rects, rectCount);
+}
+
+void AB_CTFrameGetRectsForRangeWithAggregationType(CTFrameRef frame, CFRange range, AB_CTLineRectAggregationType aggregationType, CGRect rects[], CFIndex *rectCount)
+{
+	AB_CTFrameMetricsRef metrics = AB_CTFrameMetricsCreate(frame);
+	AB_CTFrameMetricsGetRectsForRange(metrics, range, aggregationType, rects, rectCount);
+	AB_CTFrameMetricsRelease(metrics);
+}
+
+void AB_CTLinesGetRectsForRangeWithAggregationType(NSArray *lines, CGPoint *lineOrigins, CGRect bounds, CFRange range, AB_CTLineRectAggregationType aggregationType, CGRect rects[], CFIndex *rectCount)
+{
+	CFIndex linesCount = [lines count];
+	AB_CTLineMetrics *metrics = malloc(sizeof(AB_CTLineMetrics) * MAX(linesCount, 1));
+	for(CFIndex i = 0; i < linesCount; ++i) {
+		AB_CTLineMetricsFill(&metrics[i], (__bridge CTLineRef)[lines objectAtIndex:i], lineOrigins[i]);
+	}
+	
+	AB_CTLineMetricsGetRectsForRange(metrics, linesCount, bounds, range, aggregationType, rects, rectCount);
+	free(metrics);
+}
@@ -0,0 +1,60 @@
+/*
+ Copyright 2011 Twitter, Inc.
+ 
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this work except in compliance with the License.
+ You may obtain a copy of the License in the LICENSE file, or at:
+ 
+ http://www.apache.org/licenses/LICENSE-2.0
+ 
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#import <Cocoa/Cocoa.h>
+
+/*
+ * A cache of images made from other images, such as decoded or derived
+ * copies, each keyed by the image it was made from and the parameters it was
+ * made with. An entry costs the bytes of its bitmap, and the cache evicts
+ * entries once their total passes its memory limit. The cache doesn't keep
+ * source images alive: an image's entries are removed when it's deallocated.
+ * Entries may be CGImages or NSImages. Safe to use from any thread.
+ */
+@interface TUIImageCache : NSObject
+
+/*
+ * Initializes a cache holding up to `bytes` of bitmaps.
+ *
+ * This is the designated initializer.
+ */
+- (id)initWithMemoryLimit:(NSUInteger)bytes;
+
+@property (nonatomic, assign) NSUInteger memoryLimit;
+
+/*
+ * The number of counted lookups that found an entry, and that didn't.
+ */
+@property (nonatomic, readonly) NSUInteger hitCount;
+@property (nonatomic, readonly) NSUInteger missCount;
+
+/*
+ * Returns the entry made from `image` with the given parameters, or nil if
+ * there's none. The lookup is counted as a hit or a miss only if
+ * `countsLookup` is YES, so lookups made while making another entry can be
+ * left out.
+ */
+- (id)objectForImage:(NSImage *)image parameters:(NSArray *)parameters countsLookup:(BOOL)countsLookup;
+
+/*
+ * Adds an entry made from `image` with the given parameters. The entry is
+ * handed out as is, so it mustn't be changed once it's in the cache.
+ */
+- (void)setObject:(id)object forImage:(NSImage *)image parameters:(NSArray *)parameters;
+
+- (void)removeAllObjects;
+
+@end
@@ -0,0 +1,256 @@
+/*
+ Copyright 2011 Twitter, Inc.
+ 
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this work except in compliance with the License.
+ You may obtain a copy of the License in the LICENSE file, or at:
+ 
+ http://www.apache.org/licenses/LICENSE-2.0
+ 
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#import "TUIImageCache.h"
+#import <libkern/OSAtomic.h>
+#import <objc/runtime.h>
+
+#define SOURCE_KEYS_MINIMUM_PRUNE_COUNT 16
+
+@interface TUIImageCache ()
+{
+	NSCache *_cache;
+	volatile int64_t _hitCount;
+	volatile int64_t _missCount;
+}
+- (void)_removeObjectsForKeys:(NSSet *)keys;
+- (BOOL)_containsObjectForKey:(id)key;
+@end
+
+/*
+ * Keys name their source image by the number of its source token rather than
+ * holding on to it, so cached images don't keep their sources alive. Numbers
+ * are never reused, unlike the addresses of deallocated images.
+ */
+@interface TUIImageCacheKey : NSObject <NSCopying>
+{
+	@public
+	uint64_t source;
+	NSArray *parameters;
+	NSUInteger hashValue;
+}
+@end
+
+@implementation TUIImageCacheKey
+
+- (id)copyWithZone:(NSZone *)zone
+{
+	return self;
+}
+
+- (NSUInteger)hash
+{
+	return hashValue;
+}
+
+- (BOOL)isEqual:(id)object
+{
+	if(![object isKindOfClass:[TUIImageCacheKey class]])
+		return NO;
+	TUIImageCacheKey *key = object;
+	return key->source == source && [key->parameters isEqualToArray:parameters];
+}
+
+@end
+
+static TUIImageCacheKey *TUIImageCacheKeyMake(uint64_t source, NSArray *parameters)
+{
+	TUIImageCacheKey *key = [[TUIImageCacheKey alloc] init];
+	key->source = source;
+	key->parameters = [parameters copy];
+	
+	// an array's own hash is only its count
+	key->hashValue = (NSUInteger)source;
+	for(id parameter in parameters)
+		key->hashValue = key->hashValue * 31 + [parameter hash];
+	return key;
+}
+
+/*
+ * The keys of the entries made from one source image in one cache.
+ */
+@interface TUIImageCacheSourceEntries : NSObject
+{
+	@public
+	__weak TUIImageCache *cache;
+	NSMutableSet *keys;
+	NSUInteger pruneCount; // keys of evicted entries are dropped once there are this many
+}
+@end
+
+@implementation TUIImageCacheSourceEntries
+@end
+
+/*
+ * Attached to a source image the first time something made from it is
+ * cached. It goes away with the image, and takes the image's entries out of
+ * every cache with it.
+ */
+@interface TUIImageCacheSourceToken : NSObject
+{
+	@public
+	uint64_t number;
+	NSMutableArray *entries; // TUIImageCacheSourceEntries, one per cache
+}
+@end
+
+@implementation TUIImageCacheSourceToken
+
+- (void)addKey:(TUIImageCacheKey *)key forCache:(TUIImageCache *)cache
+{
+	@synchronized(self) {
+		TUIImageCacheSourceEntries *cacheEntries = nil;
+		for(TUIImageCacheSourceEntries *e in entries) {
+			if(e->cache == cache) {
+				cacheEntries = e;
+				break;
+			}
+		}
+		if(!cacheEntries) {
+			cacheEntries = [[TUIImageCacheSourceEntries alloc] init];
+			cacheEntries->cache = cache;
+			cacheEntries->keys = [NSMutableSet set];
+			cacheEntries->pruneCount = SOURCE_KEYS_MINIMUM_PRUNE_COUNT;
+			[entries addObject:cacheEntries];
+		}
+		
+		[cacheEntries->keys addObject:key];
+		if([cacheEntries->keys count] >= cacheEntries->pruneCount) {
+			// forget the keys of entries the cache has evicted since
+			for(TUIImageCacheKey *k in [cacheEntries->keys allObjects]) {
+				if(![cache _containsObjectForKey:k])
+					[cacheEntries->keys removeObject:k];
+			}
+			cacheEntries->pruneCount = MAX([cacheEntries->keys count] * 2, SOURCE_KEYS_MINIMUM_PRUNE_COUNT);
+		}
+	}
+}
+
+- (void)dealloc
+{
+	for(TUIImageCacheSourceEntries *e in entries) {
+		TUIImageCache *cache = e->cache;
+		[cache _removeObjectsForKeys:e->keys];
+	}
+}
+
+@end
+
+static char TUIImageCacheSourceTokenKey;
+static volatile int64_t TUIImageCacheSourceTokenCount = 0;
+
+static TUIImageCacheSourceToken *TUIImageCacheSourceTokenForImage(NSImage *image, BOOL create)
+{
+	TUIImageCacheSourceToken *token = objc_getAssociatedObject(image, &TUIImageCacheSourceTokenKey);
+	if(token || !create)
+		return token;
+	
+	@synchronized(image) {
+		token = objc_getAssociatedObject(image, &TUIImageCacheSourceTokenKey);
+		if(!token) {
+			token = [[TUIImageCacheSourceToken alloc] init];
+			token->number = (uint64_t)OSAtomicIncrement64(&TUIImageCacheSourceTokenCount);
+			token->entries = [NSMutableArray array];
+			objc_setAssociatedObject(image, &TUIImageCacheSourceTokenKey, token, OBJC_ASSOCIATION_RETAIN);
+		}
+		return token;
+	}
+}
+
+static NSUInteger TUIImageCacheCostOfObject(id object)
+{
+	CGImageRef image = NULL;
+	if([object isKindOfClass:[NSImage class]])
+		image = [(NSImage *)object CGImageForProposedRect:NULL context:nil hints:nil];
+	else if(CFGetTypeID((__bridge CFTypeRef)object) == CGImageGetTypeID())
+		image = (__bridge CGImageRef)object;
+	
+	return image ? CGImageGetBytesPerRow(image) * CGImageGetHeight(image) : 0;
+}
+
+@implementation TUIImageCache
+
+- (id)init
+{
+	return [self initWithMemoryLimit:0];
+}
+
+- (id)initWithMemoryLimit:(NSUInteger)bytes
+{
+	if((self = [super init])) {
+		_cache = [[NSCache alloc] init];
+		_cache.totalCostLimit = bytes;
+	}
+	return self;
+}
+
+- (NSUInteger)memoryLimit
+{
+	return _cache.totalCostLimit;
+}
+
+- (void)setMemoryLimit:(NSUInteger)bytes
+{
+	_cache.totalCostLimit = bytes;
+}
+
+- (NSUInteger)hitCount
+{
+	return (NSUInteger)_hitCount;
+}
+
+- (NSUInteger)missCount
+{
+	return (NSUInteger)_missCount;
+}
+
+- (id)objectForImage:(NSImage *)image parameters:(NSArray *)parameters countsLookup:(BOOL)countsLookup
+{
+	TUIImageCacheSourceToken *token = TUIImageCacheSourceTokenForImage(image, NO);
+	id object = token ? [_cache objectForKey:TUIImageCacheKeyMake(token->number, parameters)] : nil;
+	if(countsLookup)
+		OSAtomicIncrement64(object ? &_hitCount : &_missCount);
+	return object;
+}
+
+- (void)setObject:(id)object forImage:(NSImage *)image parameters:(NSArray *)parameters
+{
+	if(!object || !image)
+		return;
+	
+	TUIImageCacheSourceToken *token = TUIImageCacheSourceTokenForImage(image, YES);
+	TUIImageCacheKey *key = TUIImageCacheKeyMake(token->number, parameters);
+	[_cache setObject:object forKey:key cost:TUIImageCacheCostOfObject(object)];
+	[token addKey:key forCache:self];
+}
+
+- (void)removeAllObjects
+{
+	[_cache removeAllObjects];
+}
+
+- (void)_removeObjectsForKeys:(NSSet *)keys
+{
+	for(id key in keys)
+		[_cache removeObjectForKey:key];
+}
+
+- (BOOL)_containsObjectForKey:(id)key
+{
+	return [_cache objectForKey:key] != nil;
+}
+
+@end
@@ -38,6 +38,15 @@
  */
 - (CGImageRef)tui_CGImageForProposedRect:(CGRect *)rectPtr CGContext:(CGContextRef)context;
 
+/*
+ * Returns a CGImage of the receiver with `scale` pixels per point, to use as
+ * the contents of a layer with that contents scale. The receiver's own bitmap
+ * is returned when it already has that many pixels, otherwise the receiver is
+ * drawn into a new one, which is kept in the derived image cache for the next
+ * call at the same size. The caller is responsible for releasing the image.
+ */
+- (CGImageRef)tui_copyCGImageForContentsScale:(CGFloat)scale CF_RETURNS_RETAINED;
+
 /*
  * Draws the whole image originating at the given point.
  */
@@ -54,6 +63,20 @@
  */
 - (TUIStretchableImage *)tui_resizableImageWithCapInsets:(TUIEdgeInsets)insets;
 
+/*
+ * The images returned by the methods below are cached, keyed by the receiver,
+ * the operation and its parameters, and the main screen's scale for those
+ * drawn at it, so asking for the same image again returns the one made the
+ * first time. They're shared, so don't modify them (or the receiver, once
+ * images have been derived from it). Only the calls made from outside count
+ * as hits or misses and are cached, not the derivations they make along the
+ * way.
+ */
++ (NSUInteger)tui_derivedImageCacheHitCount;
++ (NSUInteger)tui_derivedImageCacheMissCount;
++ (void)tui_setDerivedImageCacheMemoryLimit:(NSUInteger)bytes; // default is 16MB
++ (void)tui_purgeDerivedImageCache;
+
 - (NSImage *)tui_crop:(CGRect)cropRect;
 - (NSImage *)tui_upsideDownCrop:(CGRect)cropRect;
 - (NSImage *)tui_scale:(CGSize)size;
@@ -17,10 +17,80 @@
 #import "NSImage+TUIExtensions.h"
 #import "NSColor+TUIExtensions.h"
 #import "TUICGAdditions.h"
+#import "TUIImageCache.h"
 #import "TUIStretchableImage.h"
+#import <pthread.h>
+
+#define DERIVED_IMAGE_CACHE_DEFAULT_MEMORY_LIMIT (16 * 1024 * 1024)
+
+static TUIImageCache *TUIDerivedImageCache = nil;
+static pthread_key_t TUIDerivedImageDepthKey;
+
+static TUIImageCache *TUIDerivedImageCacheGet(void)
+{
+	static dispatch_once_t onceToken;
+	dispatch_once(&onceToken, ^{
+		TUIDerivedImageCache = [[TUIImageCache alloc] initWithMemoryLimit:DERIVED_IMAGE_CACHE_DEFAULT_MEMORY_LIMIT];
+		pthread_key_create(&TUIDerivedImageDepthKey, NULL);
+	});
+	return TUIDerivedImageCache;
+}
+
+/*
+ * Returns the image made by `operation` on `source` with the given
+ * parameters, calling `make` only if it isn't in the cache yet. Images drawn
+ * at the main screen's scale have it added to their key.
+ *
+ * Only the outermost derivation on a thread counts towards the hit and miss
+ * counts and is cached, not the intermediate images it makes along the way.
+ */
+static NSImage *TUIDerivedImage(NSImage *source, SEL operation, NSArray *parameters, BOOL dependsOnScale, NSImage *(^make)(void))
+{
+	TUIImageCache *cache = TUIDerivedImageCacheGet();
+	
+	NSMutableArray *keyParameters = [NSMutableArray arrayWithObject:NSStringFromSelector(operation)];
+	[keyParameters addObjectsFromArray:parameters];
+	if(dependsOnScale) {
+		CGFloat scale = [[NSScreen mainScreen] respondsToSelector:@selector(backingScaleFactor)] ? [[NSScreen mainScreen] backingScaleFactor] : 1.0f;
+		[keyParameters addObject:@(scale)];
+	}
+	
+	uintptr_t depth = (uintptr_t)pthread_getspecific(TUIDerivedImageDepthKey);
+	NSImage *image = [cache objectForImage:source parameters:keyParameters countsLookup:(depth == 0)];
+	if(!image) {
+		pthread_setspecific(TUIDerivedImageDepthKey, (void *)(depth + 1));
+		image = make();
+		pthread_setspecific(TUIDerivedImageDepthKey, (void *)depth);
+		
+		if(depth == 0)
+			[cache setObject:image forImage:source parameters:keyParameters];
+	}
+	
+	return image;
+}
 
 @implementation NSImage (TUIExtensions)
 
++ (NSUInteger)tui_derivedImageCacheHitCount
+{
+	return TUIDerivedImageCacheGet().hitCount;
+}
+
++ (NSUInteger)tui_derivedImageCacheMissCount
+{
+	return TUIDerivedImageCacheGet().missCount;
+}
+
++ (void)tui_setDerivedImageCacheMemoryLimit:(NSUInteger)bytes
+{
+	TUIDerivedImageCacheGet().memoryLimit = bytes;
+}
+
++ (void)tui_purgeDerivedImageCache
+{
+	[TUIDerivedImageCacheGet() removeAllObjects];
+}
+
 + (NSImage *)tui_imageWithCGImage:(CGImageRef)cgImage {
 	CGSize size = CGSizeMake(CGImageGetWidth(cgImage), CGImageGetHeight(cgImage));
 	return [[self alloc] initWithCGImage:cgImage size:size];
@@ -54,6 +124,39 @@
 	return [self CGImageForProposedRect:rectPtr context:graphicsContext hints:nil];
 }
 
+- (CGImageRef)tui_copyCGImageForContentsScale:(CGFloat)scale
+{
+	CGSize size = self.size;
+	CGSize pixelSize = CGSizeMake(ceil(size.width * scale), ceil(size.height * scale));
+	if(pixelSize.width < 1 || pixelSize.height < 1)
+		return NULL;
+	
+	// only bitmaps that had to be drawn are cached, an image's own bitmap is returned as is
+	TUIImageCache *cache = TUIDerivedImageCacheGet();
+	NSArray *parameters = @[NSStringFromSelector(_cmd), [NSValue valueWithSize:pixelSize]];
+	id cachedImage = [cache objectForImage:self parameters:parameters countsLookup:NO];
+	if(cachedImage)
+		return CGImageRetain((__bridge CGImageRef)cachedImage);
+	
+	CGRect pixelRect = CGRectMake(0, 0, pixelSize.width, pixelSize.height);
+	CGRect proposedRect = pixelRect;
+	CGImageRef image = [self CGImageForProposedRect:&proposedRect context:nil hints:nil];
+	if(!image)
+		return NULL;
+	if(CGImageGetWidth(image) == pixelSize.width && CGImageGetHeight(image) == pixelSize.height)
+		return CGImageRetain(image);
+	
+	// the best representation is the wrong size, scale it to the size we want
+	CGContextRef ctx = TUICreateGraphicsContextWithOptions(pixelSize, NO);
+	CGContextSetInterpolationQuality(ctx, kCGInterpolationHigh);
+	CGContextDrawImage(ctx, pixelRect, image);
+	image = CGBitmapContextCreateImage(ctx);
+	CGContextRelease(ctx);
+	
+	[cache setObject:(__bridge id)image forImage:self parameters:parameters];
+	return image;
+}
+
 - (void)tui_drawAtPoint:(CGPoint)point
 {
 	[self drawAtPoint:point fromRect:NSZeroRect operation:NSCompositeSourceOver fraction:1.0];
@@ -74,12 +177,14 @@
 
 - (NSImage *)tui_scale:(CGSize)size
 {
-	return [NSImage tui_imageWithSize:size drawing:^(CGContextRef ctx) {
-		CGRect r;
-		r.origin = CGPointZero;
-		r.size = size;
-		CGContextDrawImage(ctx, r, self.tui_CGImage);
-	}];
+	return TUIDerivedImage(self, _cmd, @[[NSValue valueWithSize:size]], YES, ^ NSImage * {
+		return [NSImage tui_imageWithSize:size drawing:^(CGContextRef ctx) {
+			CGRect r;
+			r.origin = CGPointZero;
+			r.size = size;
+			CGContextDrawImage(ctx, r, self.tui_CGImage);
+		}];
+	});
 }
 
 - (NSImage *)tui_crop:(CGRect)cropRect
@@ -91,24 +196,28 @@
 	CGFloat mx = cropRect.origin.x + cropRect.size.width;
 	CGFloat my = cropRect.origin.y + cropRect.size.height;
 	if((cropRect.origin.x >= 0.0) && (cropRect.origin.y >= 0.0) && (mx <= s.width) && (my <= s.height)) {
-		// fast crop
-		CGImageRef cgimage = CGImageCreateWithImageInRect(self.tui_CGImage, cropRect);
-		if(!cgimage) {
-			NSLog(@"CGImageCreateWithImageInRect failed %@ %@", NSStringFromRect(cropRect), NSStringFromSize(s));
-			return nil;
-		}
-		NSImage *i = [NSImage tui_imageWithCGImage:cgimage];
-		CGImageRelease(cgimage);
-		return i;
+		// fast crop - the same at any scale
+		return TUIDerivedImage(self, _cmd, @[[NSValue valueWithRect:cropRect]], NO, ^ NSImage * {
+			CGImageRef cgimage = CGImageCreateWithImageInRect(self.tui_CGImage, cropRect);
+			if(!cgimage) {
+				NSLog(@"CGImageCreateWithImageInRect failed %@ %@", NSStringFromRect(cropRect), NSStringFromSize(s));
+				return nil;
+			}
+			NSImage *i = [NSImage tui_imageWithCGImage:cgimage];
+			CGImageRelease(cgimage);
+			return i;
+		});
 	} else {
 		// slow crop - probably doing pad
-		return [NSImage tui_imageWithSize:cropRect.size drawing:^(CGContextRef ctx) {
-			CGRect imageRect;
-			imageRect.origin.x = -cropRect.origin.x;
-			imageRect.origin.y = -cropRect.origin.y;
-			imageRect.size = s;
-			CGContextDrawImage(ctx, imageRect, self.tui_CGImage);
-		}];
+		return TUIDerivedImage(self, _cmd, @[[NSValue valueWithRect:cropRect]], YES, ^ NSImage * {
+			return [NSImage tui_imageWithSize:cropRect.size drawing:^(CGContextRef ctx) {
+				CGRect imageRect;
+				imageRect.origin.x = -cropRect.origin.x;
+				imageRect.origin.y = -cropRect.origin.y;
+				imageRect.size = s;
+				CGContextDrawImage(ctx, imageRect, self.tui_CGImage);
+			}];
+		});
 	}
 }
 
@@ -144,68 +253,76 @@
 
 - (NSImage *)tui_roundImage:(CGFloat)radius
 {
-	CGRect r;
-	r.origin = CGPointZero;
-	r.size = self.size;
-	return [NSImage tui_imageWithSize:r.size drawing:^(CGContextRef ctx) {
-		CGContextClipToRoundRect(ctx, r, radius);
-		CGContextDrawImage(ctx, r, self.tui_CGImage);
-	}];
+	return TUIDerivedImage(self, _cmd, @[@(radius)], YES, ^ NSImage * {
+		CGRect r;
+		r.origin = CGPointZero;
+		r.size = self.size;
+		return [NSImage tui_imageWithSize:r.size drawing:^(CGContextRef ctx) {
+			CGContextClipToRoundRect(ctx, r, radius);
+			CGContextDrawImage(ctx, r, self.tui_CGImage);
+		}];
+	});
 }
 
 - (NSImage *)tui_invertedMask
 {
-	CGSize s = self.size;
-	return [NSImage tui_imageWithSize:s drawing:^(CGContextRef ctx) {
-		CGRect rect = CGRectMake(0, 0, s.width, s.height);
-		CGContextSetRGBFillColor(ctx, 0, 0, 0, 1);
-		CGContextFillRect(ctx, rect);
-		CGContextSaveGState(ctx);
-		CGContextClipToMask(ctx, rect, self.tui_CGImage);
-		CGContextClearRect(ctx, rect);
-		CGContextRestoreGState(ctx);
-	}];
+	return TUIDerivedImage(self, _cmd, @[], YES, ^ NSImage * {
+		CGSize s = self.size;
+		return [NSImage tui_imageWithSize:s drawing:^(CGContextRef ctx) {
+			CGRect rect = CGRectMake(0, 0, s.width, s.height);
+			CGContextSetRGBFillColor(ctx, 0, 0, 0, 1);
+			CGContextFillRect(ctx, rect);
+			CGContextSaveGState(ctx);
+			CGContextClipToMask(ctx, rect, self.tui_CGImage);
+			CGContextClearRect(ctx, rect);
+			CGContextRestoreGState(ctx);
+		}];
+	});
 }
 
 - (NSImage *)tui_innerShadowWithOffset:(CGSize)offset radius:(CGFloat)radius color:(NSColor *)color backgroundColor:(NSColor *)backgroundColor
 {
-	CGFloat padding = ceil(radius);
-	NSImage *paddedImage = [self tui_pad:padding];
-	NSImage *shadowImage = [NSImage tui_imageWithSize:paddedImage.size drawing:^(CGContextRef ctx) {
-		CGContextSaveGState(ctx);
-		CGRect r = CGRectMake(0, 0, paddedImage.size.width, paddedImage.size.height);
-		CGContextClipToMask(ctx, r, paddedImage.tui_CGImage); // clip to image
-		CGContextSetShadowWithColor(ctx, offset, radius, color.tui_CGColor);
-		CGContextBeginTransparencyLayer(ctx, NULL);
-		{
-			CGContextClipToMask(ctx, r, [[paddedImage tui_invertedMask] tui_CGImage]); // clip to inverted
-			CGContextSetFillColorWithColor(ctx, backgroundColor.tui_CGColor);
-			CGContextFillRect(ctx, r); // draw with shadow
-		}
-
-		CGContextEndTransparencyLayer(ctx);
-		CGContextRestoreGState(ctx);
-	}];
+	return TUIDerivedImage(self, _cmd, @[[NSValue valueWithSize:offset], @(radius), color ?: [NSNull null], backgroundColor ?: [NSNull null]], YES, ^ NSImage * {
+		CGFloat padding = ceil(radius);
+		NSImage *paddedImage = [self tui_pad:padding];
+		NSImage *shadowImage = [NSImage tui_imageWithSize:paddedImage.size drawing:^(CGContextRef ctx) {
+			CGContextSaveGState(ctx);
+			CGRect r = CGRectMake(0, 0, paddedImage.size.width, paddedImage.size.height);
+			CGContextClipToMask(ctx, r, paddedImage.tui_CGImage); // clip to image
+			CGContextSetShadowWithColor(ctx, offset, radius, color.tui_CGColor);
+			CGContextBeginTransparencyLayer(ctx, NULL);
+			{
+				CGContextClipToMask(ctx, r, [[paddedImage tui_invertedMask] tui_CGImage]); // clip to inverted
+				CGContextSetFillColorWithColor(ctx, backgroundColor.tui_CGColor);
+				CGContextFillRect(ctx, r); // draw with shadow
+			}
+
+			CGContextEndTransparencyLayer(ctx);
+			CGContextRestoreGState(ctx);
+		}];
 	
-	return [shadowImage tui_pad:-padding];
+		return [shadowImage tui_pad:-padding];
+	});
 }
 
 - (NSImage *)tui_embossMaskWithOffset:(CGSize)offset
 {
-	CGFloat padding = MAX(offset.width, offset.height) + 1;
-	NSImage *paddedImage = [self tui_pad:padding];
-	CGSize s = paddedImage.size;
-	NSImage *embossedImage = [NSImage tui_imageWithSize:s drawing:^(CGContextRef ctx) {
-		CGContextSaveGState(ctx);
-		CGRect r = CGRectMake(0, 0, s.width, s.height);
-		CGContextClipToMask(ctx, r, [paddedImage tui_CGImage]);
-		CGContextClipToMask(ctx, CGRectOffset(r, offset.width, offset.height), [[paddedImage tui_invertedMask] tui_CGImage]);
-		CGContextSetRGBFillColor(ctx, 0, 0, 0, 1);
-		CGContextFillRect(ctx, r);
-		CGContextRestoreGState(ctx);
-	}];
+	return TUIDerivedImage(self, _cmd, @[[NSValue valueWithSize:offset]], YES, ^ NSImage * {
+		CGFloat padding = MAX(offset.width, offset.height) + 1;
+		NSImage *paddedImage = [self tui_pad:padding];
+		CGSize s = paddedImage.size;
+		NSImage *embossedImage = [NSImage tui_imageWithSize:s drawing:^(CGContextRef ctx) {
+			CGContextSaveGState(ctx);
+			CGRect r = CGRectMake(0, 0, s.width, s.height);
+			CGContextClipToMask(ctx, r, [paddedImage tui_CGImage]);
+			CGContextClipToMask(ctx, CGRectOffset(r, offset.width, offset.height), [[paddedImage tui_invertedMask] tui_CGImage]);
+			CGContextSetRGBFillColor(ctx, 0, 0, 0, 1);
+			CGContextFillRect(ctx, r);
+			CGContextRestoreGState(ctx);
+		}];
 	
-	return [embossedImage tui_pad:-padding];
+		return [embossedImage tui_pad:-padding];
+	});
 }
 
 @end
@@ -15,6 +15,7 @@
  */
 
 #import "TUIButton.h"
+#import "NSImage+TUIExtensions.h"
 #import "TUICGAdditions.h"
 #import "TUIControl+Private.h"
 #import "TUIImageView.h"
@@ -22,6 +23,8 @@
 #import "TUINSView.h"
 #import "TUIStretchableImage.h"
 #import "TUITextRenderer.h"
+#import "TUIView+Private.h"
+#import <objc/runtime.h>
 
 @interface TUIButton ()
 
@@ -242,6 +245,68 @@ static CGRect ButtonRectCenteredInRect(CGRect a, CGRect b)
 	CGContextRestoreGState(ctx);
 }
 
+/*
+ * A button showing nothing but a stretchable background image doesn't draw,
+ * its layer is given the image and stretches it itself (see TUIImageView).
+ */
+- (BOOL)_displaysBackgroundImageAsLayerContents
+{
+	if(self.drawRect != nil || TUIViewRenderingTraitsForClass(object_getClass(self))->drawRectIMP != TUIViewRenderingTraitsForClass([TUIButton class])->drawRectIMP)
+		return NO;
+	if(self.currentImage != nil || self.currentTitle != nil || [_titleView.text length] > 0)
+		return NO;
+	if(!CGRectEqualToRect([self backgroundRectForBounds:self.bounds], self.bounds))
+		return NO;
+	if(![self.layer.contentsGravity isEqualToString:kCAGravityResize]) // only then does the layer use contentsCenter
+		return NO;
+	
+	return [self.currentBackgroundImage isKindOfClass:[TUIStretchableImage class]];
+}
+
+- (void)displayLayer:(CALayer *)layer
+{
+	if(![self _displaysBackgroundImageAsLayerContents]) {
+		layer.contentsCenter = CGRectMake(0, 0, 1, 1);
+		layer.needsDisplayOnBoundsChange = YES;
+		[super displayLayer:layer];
+		return;
+	}
+	
+	// the layer stretches the image to any size, see -layoutSublayersOfLayer:
+	layer.needsDisplayOnBoundsChange = NO;
+	
+	if(_buttonFlags.firstDraw) {
+		[self _update];
+		_buttonFlags.firstDraw = 0;
+	}
+	
+	[self cancelBackgroundDrawing];
+	
+	TUIStretchableImage *backgroundImage = (TUIStretchableImage *)self.currentBackgroundImage;
+	CGFloat scale = [layer respondsToSelector:@selector(contentsScale)] ? layer.contentsScale : 1.0f;
+	CGImageRef image = [backgroundImage tui_copyCGImageForContentsScale:scale];
+	layer.contents = (__bridge id)image;
+	layer.contentsCenter = backgroundImage.tui_contentsCenter;
+	CGImageRelease(image);
+	
+	[self _releaseCGContexts];
+}
+
+- (void)setContentMode:(TUIViewContentMode)contentMode
+{
+	[super setContentMode:contentMode];
+	[self setNeedsDisplay];
+}
+
+- (void)layoutSublayersOfLayer:(CALayer *)layer
+{
+	[super layoutSublayersOfLayer:layer];
+	
+	// a new size may move the background off the bounds, and then it's drawn
+	if(!layer.needsDisplayOnBoundsChange && ![self _displaysBackgroundImageAsLayerContents])
+		[self setNeedsDisplay];
+}
+
 - (void)mouseDown:(NSEvent *)event
 {
 	[super mouseDown:event];
@@ -36,6 +36,28 @@ extern CGContextRef TUICreateGraphicsContext(CGSize size);
 extern CGContextRef TUICreateGraphicsContextWithOptions(CGSize size, BOOL opaque);
 extern CGImageRef TUICreateCGImageFromBitmapContext(CGContextRef ctx);
 
+/**
+ Returns an image which shares the bitmap context's memory instead of copying it.
+ The image keeps the context alive, and drawing into the context afterwards changes
+ the image, so callers must not draw into the context again while the image is in use.
+ */
+extern CGImageRef TUICreateCGImageSharingBitmapContext(CGContextRef ctx);
+
+/**
+ Like TUICreateGraphicsContextWithOptions, but the bitmap memory is borrowed from a
+ process-wide pool and handed back to it when the context is freed. Use this for
+ backing stores which are thrown away and recreated often, e.g. on every frame of a
+ live resize. The returned context is cleared, like a freshly allocated one.
+ */
+extern CGContextRef TUICreatePooledGraphicsContextWithOptions(CGSize size, BOOL opaque);
+
+/**
+ The most memory the bitmap pool keeps around for reuse. Buffers are evicted least
+ recently used first. Setting 0 empties the pool. Defaults to 64MB.
+ */
+extern void TUISetBitmapPoolMemoryBudget(size_t bytes);
+extern size_t TUIBitmapPoolMemoryBudget(void);
+
 extern CGPathRef TUICGPathCreateRoundedRect(CGRect rect, CGFloat radius);
 extern CGPathRef TUICGPathCreateRoundedRectWithCorners(CGRect rect, CGFloat radius, TUICGRoundedRectCorner corners);
 extern void CGContextAddRoundRect(CGContextRef context, CGRect rect, CGFloat radius);
@@ -15,8 +15,11 @@
  */
 
 #import "TUICGAdditions.h"
+#import <pthread.h>
 #import "TUIView.h"
 
+#define BITMAP_POOL_DEFAULT_MEMORY_BUDGET (64 * 1024 * 1024)
+
 CGContextRef TUICreateOpaqueGraphicsContext(CGSize size)
 {
 	size_t width = size.width;
@@ -58,6 +61,156 @@ CGImageRef TUICreateCGImageFromBitmapContext(CGContextRef ctx) // autoreleased
 	return CGBitmapContextCreateImage(ctx);
 }
 
+static void TUIReleaseSharedBitmapContext(void *info, const void *data, size_t size)
+{
+	CGContextRelease((CGContextRef)info);
+}
+
+CGImageRef TUICreateCGImageSharingBitmapContext(CGContextRef ctx)
+{
+	void *data = CGBitmapContextGetData(ctx);
+	if(!data)
+		return NULL;
+	
+	size_t bytesPerRow = CGBitmapContextGetBytesPerRow(ctx);
+	size_t height = CGBitmapContextGetHeight(ctx);
+	CGDataProviderRef provider = CGDataProviderCreateWithData(CGContextRetain(ctx), data, bytesPerRow * height, TUIReleaseSharedBitmapContext);
+	CGImageRef image = CGImageCreate(CGBitmapContextGetWidth(ctx), height,
+									 CGBitmapContextGetBitsPerComponent(ctx), CGBitmapContextGetBitsPerPixel(ctx), bytesPerRow,
+									 CGBitmapContextGetColorSpace(ctx), CGBitmapContextGetBitmapInfo(ctx),
+									 provider, NULL, false, kCGRenderingIntentDefault);
+	CGDataProviderRelease(provider);
+	return image;
+}
+
+/*
+ * Free bitmap buffers waiting to be reused, most recently returned first.
+ * Buffers are bucketed by size class, so a view that grows by a few pixels
+ * during a live resize can usually take back the buffer it just gave up.
+ */
+typedef struct TUIBitmapPoolBuffer {
+	void *data;
+	size_t size;
+	struct TUIBitmapPoolBuffer *next;
+} TUIBitmapPoolBuffer;
+
+static pthread_mutex_t TUIBitmapPoolLock = PTHREAD_MUTEX_INITIALIZER;
+static TUIBitmapPoolBuffer *TUIBitmapPoolBuffers = NULL;
+static size_t TUIBitmapPoolSize = 0;
+static size_t TUIBitmapPoolBudget = BITMAP_POOL_DEFAULT_MEMORY_BUDGET;
+
+static size_t TUIBitmapPoolSizeClass(size_t bytes)
+{
+	// round up to an eighth of the next power of two, wasting at most 12.5%
+	size_t powerOfTwo = 4096;
+	while(powerOfTwo < bytes)
+		powerOfTwo <<= 1;
+	size_t step = MAX(powerOfTwo / 8, 4096);
+	return (bytes + step - 1) / step * step;
+}
+
+// call with the lock held
+static void TUIBitmapPoolEvictToBudget(void)
+{
+	while(TUIBitmapPoolSize > TUIBitmapPoolBudget) {
+		// the least recently used buffer is the last one
+		TUIBitmapPoolBuffer **last = &TUIBitmapPoolBuffers;
+		while((*last)->next)
+			last = &(*last)->next;
+		
+		TUIBitmapPoolBuffer *buffer = *last;
+		*last = NULL;
+		TUIBitmapPoolSize -= buffer->size;
+		free(buffer->data);
+		free(buffer);
+	}
+}
+
+static void *TUIBitmapPoolBorrow(size_t size)
+{
+	void *data = NULL;
+	
+	pthread_mutex_lock(&TUIBitmapPoolLock);
+	for(TUIBitmapPoolBuffer **b = &TUIBitmapPoolBuffers; *b; b = &(*b)->next) {
+		if((*b)->size == size) {
+			TUIBitmapPoolBuffer *buffer = *b;
+			*b = buffer->next;
+			TUIBitmapPoolSize -= size;
+			data = buffer->data;
+			free(buffer);
+			break;
+		}
+	}
+	pthread_mutex_unlock(&TUIBitmapPoolLock);
+	
+	if(data) {
+		memset(data, 0, size);
+		return data;
+	}
+	return calloc(1, size);
+}
+
+static void TUIBitmapPoolReturn(void *releaseInfo, void *data)
+{
+	size_t size = (size_t)releaseInfo;
+	
+	pthread_mutex_lock(&TUIBitmapPoolLock);
+	if(size > TUIBitmapPoolBudget) {
+		pthread_mutex_unlock(&TUIBitmapPoolLock);
+		free(data);
+		return;
+	}
+	
+	TUIBitmapPoolBuffer *buffer = malloc(sizeof(TUIBitmapPoolBuffer));
+	buffer->data = data;
+	buffer->size = size;
+	buffer->next = TUIBitmapPoolBuffers;
+	TUIBitmapPoolBuffers = buffer;
+	TUIBitmapPoolSize += size;
+	TUIBitmapPoolEvictToBudget();
+	pthread_mutex_unlock(&TUIBitmapPoolLock);
+}
+
+CGContextRef TUICreatePooledGraphicsContextWithOptions(CGSize size, BOOL opaque)
+{
+	size_t width = size.width;
+	size_t height = size.height;
+	if(width == 0 || height == 0)
+		return NULL;
+	
+	size_t bitsPerComponent = 8;
+	size_t bytesPerRow = 4 * width;
+	size_t bufferSize = TUIBitmapPoolSizeClass(bytesPerRow * height);
+	void *data = TUIBitmapPoolBorrow(bufferSize);
+	if(!data)
+		return NULL;
+	
+	CGColorSpaceRef colorSpace = CGColorSpaceCreateDeviceRGB();
+	CGBitmapInfo bitmapInfo = kCGBitmapByteOrder32Host | (opaque ? kCGImageAlphaNoneSkipFirst : kCGImageAlphaPremultipliedFirst);
+	CGContextRef ctx = CGBitmapContextCreateWithData(data, width, height, bitsPerComponent, bytesPerRow, colorSpace, bitmapInfo, TUIBitmapPoolReturn, (void *)bufferSize);
+	CGColorSpaceRelease(colorSpace);
+	
+	if(!ctx)
+		TUIBitmapPoolReturn((void *)bufferSize, data);
+	return ctx;
+}
+
+void TUISetBitmapPoolMemoryBudget(size_t bytes)
+{
+	pthread_mutex_lock(&TUIBitmapPoolLock);
+	TUIBitmapPoolBudget = bytes;
+	TUIBitmapPoolEvictToBudget();
+	pthread_mutex_unlock(&TUIBitmapPoolLock);
+}
+
+size_t TUIBitmapPoolMemoryBudget(void)
+{
+	pthread_mutex_lock(&TUIBitmapPoolLock);
+	size_t budget = TUIBitmapPoolBudget;
+	pthread_mutex_unlock(&TUIBitmapPoolLock);
+	return budget;
+}
+
 CGPathRef TUICGPathCreateRoundedRect(CGRect rect, CGFloat radius) {
 	return TUICGPathCreateRoundedRectWithCorners(rect, radius, TUICGRoundedRectCornerAll);
 }
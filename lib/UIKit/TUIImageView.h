@@ -22,4 +22,14 @@
 
 @property(nonatomic, strong) NSImage *image;
 
+/**
+ Sets the image, decoding it on a background queue first if `decodeAsynchronously` is YES.
+ 
+ When the image is scaled to the view (by the default content mode, or an aspect fit/fill one), it's downsampled to just cover `targetSize` at the layer's contents scale. Pass CGSizeZero for the view's bounds; while the view is live resized, the image decoded before is scaled up until it's less than half the size needed or the resize ends. The view shows nothing until the first decoded image is ready, which then replaces it on the main thread. Decoded images are shared between image views through a cache keyed by the image and the decoded size.
+ */
+- (void)setImage:(NSImage *)image decodeAsynchronously:(BOOL)decodeAsynchronously targetSize:(CGSize)targetSize;
+
++ (void)setDecodedImageCacheMemoryLimit:(NSUInteger)bytes; // default is 32MB
++ (void)purgeDecodedImageCache;
+
 @end
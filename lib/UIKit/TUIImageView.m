@@ -15,13 +15,142 @@
  */
 
 #import "TUIImageView.h"
+#import "NSImage+TUIExtensions.h"
+#import "TUICGAdditions.h"
+#import "TUIImageCache.h"
+#import "TUINSView.h"
+#import "TUIStretchableImage.h"
+#import "TUIView+Private.h"
+#import <objc/runtime.h>
+
+#define DECODED_IMAGE_CACHE_DEFAULT_MEMORY_LIMIT (32 * 1024 * 1024)
+#define DECODED_IMAGE_LIVE_RESIZE_GROWTH_LIMIT 2
+
+@interface TUIImageView () {
+	CGImageRef _decodedImage; // the image decoded in the background, NULL until it's ready
+	CGSize _targetSize;
+	CGSize _decodingPixelSize;
+	NSUInteger _decodeGeneration;
+	
+	struct {
+		unsigned int decodesAsynchronously:1;
+		unsigned int decoding:1;
+	} _imageViewFlags;
+}
+@end
+
+static TUIImageCache *TUIDecodedImageCache = nil;
+
+/*
+ * A decoded image is the same for any image view showing the same image at the
+ * same size, so they're shared through this cache.
+ */
+static TUIImageCache *TUIDecodedImageCacheGet(void)
+{
+	static dispatch_once_t onceToken;
+	dispatch_once(&onceToken, ^{
+		TUIDecodedImageCache = [[TUIImageCache alloc] initWithMemoryLimit:DECODED_IMAGE_CACHE_DEFAULT_MEMORY_LIMIT];
+	});
+	return TUIDecodedImageCache;
+}
+
+/*
+ * A decode running in the background, and what to do with its result for each
+ * image view waiting on it. Views wanting the same image at the same size wait
+ * on the one decode rather than each starting their own. Only used on the main
+ * thread.
+ */
+@interface TUIImageViewDecode : NSObject
+{
+	@public
+	NSImage *image;
+	CGSize pixelSize;
+	NSMutableArray *waiters; // blocks taking the decoded image
+}
+@end
+
+@implementation TUIImageViewDecode
+@end
+
+static NSMutableArray *TUIImageViewDecodesInFlight = nil;
+
+static TUIImageViewDecode *TUIImageViewDecodeInFlight(NSImage *image, CGSize pixelSize)
+{
+	for (TUIImageViewDecode *decode in TUIImageViewDecodesInFlight) {
+		if (decode->image == image && CGSizeEqualToSize(decode->pixelSize, pixelSize))
+			return decode;
+	}
+	return nil;
+}
+
+static BOOL TUISizeCoversSize(CGSize size, CGSize otherSize, CGFloat factor)
+{
+	return size.width * factor >= otherSize.width && size.height * factor >= otherSize.height;
+}
+
+/*
+ * Draws the best representation of the image into a bitmap of the given size,
+ * which both decodes it and scales it down. Safe to call on any thread.
+ */
+static CGImageRef TUICreateDecodedImage(NSImage *image, CGSize pixelSize)
+{
+	CGRect rect = CGRectMake(0, 0, pixelSize.width, pixelSize.height);
+	CGRect proposedRect = rect;
+	CGImageRef source = [image CGImageForProposedRect:&proposedRect context:nil hints:nil];
+	if(!source)
+		return NULL;
+	
+	CGContextRef ctx = TUICreateGraphicsContextWithOptions(pixelSize, NO);
+	CGContextSetInterpolationQuality(ctx, kCGInterpolationHigh);
+	CGContextDrawImage(ctx, rect, source);
+	CGImageRef decoded = CGBitmapContextCreateImage(ctx);
+	CGContextRelease(ctx);
+	return decoded;
+}
 
 @implementation TUIImageView
 @synthesize image = _image;
 
++ (void)setDecodedImageCacheMemoryLimit:(NSUInteger)bytes
+{
+	TUIDecodedImageCacheGet().memoryLimit = bytes;
+}
+
++ (void)purgeDecodedImageCache
+{
+	[TUIDecodedImageCacheGet() removeAllObjects];
+}
+
+- (void)_resetDecodedImage
+{
+	CGImageRelease(_decodedImage);
+	_decodedImage = NULL;
+	_decodeGeneration++; // drop any decode still in flight
+	_imageViewFlags.decoding = 0;
+}
+
+- (void)dealloc
+{
+	CGImageRelease(_decodedImage);
+}
+
 - (void)setImage:(NSImage *)i
 {
+	[self setImage:i decodeAsynchronously:NO targetSize:CGSizeZero];
+}
+
+- (void)setImage:(NSImage *)i decodeAsynchronously:(BOOL)decodeAsynchronously targetSize:(CGSize)targetSize
+{
+	[self _resetDecodedImage];
 	_image = i;
+	_imageViewFlags.decodesAsynchronously = decodeAsynchronously;
+	_targetSize = targetSize;
+	[self setNeedsDisplay];
+}
+
+- (void)setContentMode:(TUIViewContentMode)contentMode
+{
+	[super setContentMode:contentMode];
 	[self setNeedsDisplay];
 }
 
@@ -48,6 +177,192 @@
     [_image drawInRect:rect fromRect:NSZeroRect operation:NSCompositeSourceOver fraction:1.0];
 }
 
+/*
+ * Images aren't drawn at all, the layer is given the image as its contents and
+ * lays it out according to the content mode (stretchable images through its
+ * contentsCenter). That saves the view its own bitmap, and resizing the view
+ * costs no drawing. Subclasses drawing something of their own always go
+ * through -drawRect:, and so do stretchable images in any content mode but
+ * scale to fill, as the layer ignores contentsCenter with any other gravity.
+ */
+- (BOOL)_displaysImageAsLayerContents
+{
+	if (self.drawRect != nil || TUIViewRenderingTraitsForClass(object_getClass(self))->drawRectIMP != TUIViewRenderingTraitsForClass([TUIImageView class])->drawRectIMP)
+		return NO;
+	if ([_image isKindOfClass:[TUIStretchableImage class]] && ![self.layer.contentsGravity isEqualToString:kCAGravityResize])
+		return NO;
+	
+	return YES;
+}
+
+- (void)displayLayer:(CALayer *)layer
+{
+	if (![self _displaysImageAsLayerContents]) {
+		layer.contentsCenter = CGRectMake(0, 0, 1, 1);
+		layer.needsDisplayOnBoundsChange = YES;
+		[super displayLayer:layer];
+		return;
+	}
+
+	// the layer lays the image out for any size, unless it's decoded to fit the bounds
+	layer.needsDisplayOnBoundsChange = [self _decodedSizeFollowsBounds];
+
+	[self cancelBackgroundDrawing];
+
+	CGFloat scale = [layer respondsToSelector:@selector(contentsScale)] ? layer.contentsScale : 1.0f;
+	CGImageRef image = NULL;
+	if (_imageViewFlags.decodesAsynchronously && _image != nil) {
+		image = [self _copyDecodedImageForScale:scale];
+	} else {
+		image = [_image tui_copyCGImageForContentsScale:scale];
+	}
+	layer.contents = (__bridge id)image;
+	CGImageRelease(image);
+
+	if ([_image isKindOfClass:[TUIStretchableImage class]]) {
+		layer.contentsCenter = [(TUIStretchableImage *)_image tui_contentsCenter];
+	} else {
+		layer.contentsCenter = CGRectMake(0, 0, 1, 1);
+	}
+
+	// anything drawn before is no longer on screen
+	[self _releaseCGContexts];
+}
+
+/*
+ * Whether the layer scales the image to fit the view, rather than showing it
+ * at its own size.
+ */
+- (BOOL)_layerScalesImage
+{
+	if ([_image isKindOfClass:[TUIStretchableImage class]])
+		return NO;
+	
+	NSString *gravity = self.layer.contentsGravity;
+	return [gravity isEqualToString:kCAGravityResize] || [gravity isEqualToString:kCAGravityResizeAspect] || [gravity isEqualToString:kCAGravityResizeAspectFill];
+}
+
+/*
+ * Whether the image is decoded at the view's size, which changes with it.
+ */
+- (BOOL)_decodedSizeFollowsBounds
+{
+	return _imageViewFlags.decodesAsynchronously && _image != nil && CGSizeEqualToSize(_targetSize, CGSizeZero) && [self _layerScalesImage];
+}
+
+/*
+ * The size in pixels to decode the image at. Images the layer scales to fit the
+ * view are downsampled to just cover the target size, the others are decoded
+ * at their own size.
+ */
+- (CGSize)_decodedPixelSizeForScale:(CGFloat)scale
+{
+	CGSize size = _image.size;
+	CGSize pixelSize = CGSizeMake(ceil(size.width * scale), ceil(size.height * scale));
+	if (![self _layerScalesImage] || pixelSize.width < 1 || pixelSize.height < 1)
+		return pixelSize;
+	
+	CGSize targetSize = CGSizeEqualToSize(_targetSize, CGSizeZero) ? self.bounds.size : _targetSize;
+	CGFloat ratio = MAX(ceil(targetSize.width * scale) / pixelSize.width, ceil(targetSize.height * scale) / pixelSize.height);
+	if (ratio > 0 && ratio < 1) {
+		pixelSize = CGSizeMake(ceil(pixelSize.width * ratio), ceil(pixelSize.height * ratio));
+	}
+	
+	return pixelSize;
+}
+
+/*
+ * Returns the decoded image to show, from this view or the shared cache, or
+ * starts decoding it (or waits on a decode another view started) and returns
+ * NULL if there's none yet. Until the decode is done, an image decoded for
+ * another scale or a smaller size is shown instead.
+ */
+- (CGImageRef)_copyDecodedImageForScale:(CGFloat)scale CF_RETURNS_RETAINED
+{
+	CGSize pixelSize = [self _decodedPixelSizeForScale:scale];
+	if (pixelSize.width < 1 || pixelSize.height < 1)
+		return NULL;
+	
+	// while the view is live resized, the layer scales up the image decoded
+	// before rather than waiting on a new decode every frame, until that's
+	// less than half the size needed or the resize ends
+	BOOL inLiveResize = [self _decodedSizeFollowsBounds] && [self.nsView inLiveResize];
+	
+	if (_decodedImage) {
+		CGSize decodedSize = CGSizeMake(CGImageGetWidth(_decodedImage), CGImageGetHeight(_decodedImage));
+		
+		// shrinking a view that scales its image doesn't need a smaller one
+		if (CGSizeEqualToSize(decodedSize, pixelSize) || ([self _layerScalesImage] && TUISizeCoversSize(decodedSize, pixelSize, 1)))
+			return CGImageRetain(_decodedImage);
+		if (inLiveResize && TUISizeCoversSize(decodedSize, pixelSize, DECODED_IMAGE_LIVE_RESIZE_GROWTH_LIMIT))
+			return CGImageRetain(_decodedImage);
+	}
+	
+	NSImage *image = _image;
+	NSArray *parameters = @[[NSValue valueWithSize:pixelSize]];
+	id cachedImage = [TUIDecodedImageCacheGet() objectForImage:image parameters:parameters countsLookup:YES];
+	if (cachedImage) {
+		[self _resetDecodedImage];
+		_decodedImage = CGImageRetain((__bridge CGImageRef)cachedImage);
+		return CGImageRetain(_decodedImage);
+	}
+	
+	BOOL decodeInFlightSuffices = CGSizeEqualToSize(_decodingPixelSize, pixelSize) || (inLiveResize && TUISizeCoversSize(_decodingPixelSize, pixelSize, DECODED_IMAGE_LIVE_RESIZE_GROWTH_LIMIT));
+	if (!_imageViewFlags.decoding || !decodeInFlightSuffices) {
+		_imageViewFlags.decoding = 1;
+		_decodingPixelSize = pixelSize;
+		
+		// the view may be gone or showing something else by the time the decode is done
+		NSUInteger generation = ++_decodeGeneration;
+		__weak TUIImageView *weakSelf = self;
+		void (^waiter)(CGImageRef) = ^(CGImageRef decoded) {
+			TUIImageView *strongSelf = weakSelf;
+			if (strongSelf != nil && generation == strongSelf->_decodeGeneration) {
+				CGImageRelease(strongSelf->_decodedImage);
+				strongSelf->_decodedImage = decoded ? CGImageRetain(decoded) : NULL;
+				strongSelf->_imageViewFlags.decoding = 0;
+				[strongSelf setNeedsDisplay];
+			}
+		};
+		
+		TUIImageViewDecode *decode = TUIImageViewDecodeInFlight(image, pixelSize);
+		if (decode) {
+			[decode->waiters addObject:[waiter copy]];
+		} else {
+			decode = [[TUIImageViewDecode alloc] init];
+			decode->image = image;
+			decode->pixelSize = pixelSize;
+			decode->waiters = [NSMutableArray arrayWithObject:[waiter copy]];
+			if (!TUIImageViewDecodesInFlight)
+				TUIImageViewDecodesInFlight = [[NSMutableArray alloc] init];
+			[TUIImageViewDecodesInFlight addObject:decode];
+			
+			dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+				CGImageRef decoded = TUICreateDecodedImage(image, pixelSize);
+				[TUIDecodedImageCacheGet() setObject:(__bridge id)decoded forImage:image parameters:parameters];
+				
+				dispatch_async(dispatch_get_main_queue(), ^{
+					[TUIImageViewDecodesInFlight removeObjectIdenticalTo:decode];
+					for (void (^decodeWaiter)(CGImageRef) in decode->waiters)
+						decodeWaiter(decoded);
+					CGImageRelease(decoded);
+				});
+			});
+		}
+	}
+	
+	return _decodedImage ? CGImageRetain(_decodedImage) : NULL;
+}
+
+- (void)viewDidEndLiveResize
+{
+	[super viewDidEndLiveResize];
+	
+	// decode at the size the view ended up with
+	if ([self _decodedSizeFollowsBounds])
+		[self setNeedsDisplay];
+}
+
 - (CGSize)sizeThatFits:(CGSize)size {
 	return _image.size;
 }
@@ -30,4 +30,10 @@
  */
 @property (nonatomic, assign) TUIEdgeInsets tui_capInsets;
 
+/*
+ * The part of the image between the end caps, in the unit coordinate space of
+ * the image, for use as the `contentsCenter` of a layer showing the image.
+ */
+@property (nonatomic, readonly) CGRect tui_contentsCenter;
+
 @end
@@ -15,129 +15,264 @@
  */
 
 #import "TUIStretchableImage.h"
+#import <objc/runtime.h>
 
-@implementation TUIStretchableImage
+// How many sets of parts are kept per image, one for each scale it's drawn at
+// (usually 1x and 2x).
+#define TUIStretchableImageMaximumCachedParts 2
 
-#pragma mark Drawing
+static char TUIStretchableImagePartsKey;
 
-- (void)drawInRect:(NSRect)dstRect fromRect:(NSRect)srcRect operation:(NSCompositingOperation)op fraction:(CGFloat)alpha {
-	[self drawInRect:dstRect fromRect:srcRect operation:op fraction:alpha respectFlipped:YES hints:nil];
+/*
+ * The nine parts of an image, sliced along its cap insets. Parts that end up
+ * with no area are nil.
+ */
+@interface TUIStretchableImageParts : NSObject {
+@public
+	CGFloat scale; // of the context the parts were sliced for
+	TUIEdgeInsets insets;
+
+	NSImage *topLeft, *topEdge, *topRight;
+	NSImage *leftEdge, *center, *rightEdge;
+	NSImage *bottomLeft, *bottomEdge, *bottomRight;
 }
 
-- (void)drawInRect:(NSRect)dstRect fromRect:(NSRect)srcRect operation:(NSCompositingOperation)op fraction:(CGFloat)alpha respectFlipped:(BOOL)respectFlipped hints:(NSDictionary *)hints {
-	CGImageRef image = [self CGImageForProposedRect:&dstRect context:[NSGraphicsContext currentContext] hints:hints];
-	if (image == NULL) {
-		NSLog(@"*** Could not get CGImage of %@", self);
-		return;
-	}
-
-	CGSize size = CGSizeMake(CGImageGetWidth(image), CGImageGetHeight(image));
-	TUIEdgeInsets insets = self.tui_capInsets;
+/*
+ * Slices a CGImage with the given number of pixels per point along insets
+ * given in points. The parts are sized in points.
+ */
+- (id)initWithImage:(CGImageRef)image insets:(TUIEdgeInsets)insets pixelsPerPoint:(CGFloat)pixelsPerPoint;
 
-	// TODO: Cache the nine-part images for this common case of wanting to draw
-	// the whole source image.
-	if (CGRectIsEmpty(srcRect)) {
-		// Match the image creation that occurs in the 'else' clause.
-		CGImageRetain(image);
-	} else {
-		image = CGImageCreateWithImageInRect(image, srcRect);
-		if (!image) return;
+@end
 
-		// Reduce insets to account for taking only part of the original image.
-		insets.left = fmax(0, insets.left - CGRectGetMinX(srcRect));
-		insets.bottom = fmax(0, insets.bottom - CGRectGetMinY(srcRect));
+@implementation TUIStretchableImageParts
 
-		CGFloat srcRightInset = size.width - CGRectGetMaxX(srcRect);
-		insets.right = fmax(0, insets.right - srcRightInset);
+- (id)initWithImage:(CGImageRef)anImage insets:(TUIEdgeInsets)theInsets pixelsPerPoint:(CGFloat)pixelsPerPoint {
+	self = [super init];
+	if (self == nil) return nil;
 
-		CGFloat srcTopInset = size.height - CGRectGetMaxY(srcRect);
-		insets.top = fmax(0, insets.top - srcTopInset);
-	}
+	insets = theInsets;
 
-	NSImage *topLeft = nil, *topEdge = nil, *topRight = nil;
-	NSImage *leftEdge = nil, *center = nil, *rightEdge = nil;
-	NSImage *bottomLeft = nil, *bottomEdge = nil, *bottomRight = nil;
+	// Slice in pixels.
+	TUIEdgeInsets pixelInsets = TUIEdgeInsetsMake(theInsets.top * pixelsPerPoint, theInsets.left * pixelsPerPoint, theInsets.bottom * pixelsPerPoint, theInsets.right * pixelsPerPoint);
+	CGSize size = CGSizeMake(CGImageGetWidth(anImage), CGImageGetHeight(anImage));
 
 	// Length of sides that run vertically.
-	CGFloat verticalEdgeLength = fmax(0, size.height - insets.top - insets.bottom);
+	CGFloat verticalEdgeLength = fmax(0, size.height - pixelInsets.top - pixelInsets.bottom);
 
 	// Length of sides that run horizontally.
-	CGFloat horizontalEdgeLength = fmax(0, size.width - insets.left - insets.right);
+	CGFloat horizontalEdgeLength = fmax(0, size.width - pixelInsets.left - pixelInsets.right);
 
 	NSImage *(^imageWithRect)(CGRect) = ^ id (CGRect rect){
-		CGImageRef part = CGImageCreateWithImageInRect(image, rect);
+		CGImageRef part = CGImageCreateWithImageInRect(anImage, rect);
 		if (part == NULL) return nil;
 
-		NSImage *image = [[NSImage alloc] initWithCGImage:part size:rect.size];
+		NSImage *partImage = [[NSImage alloc] initWithCGImage:part size:CGSizeMake(rect.size.width / pixelsPerPoint, rect.size.height / pixelsPerPoint)];
 		CGImageRelease(part);
 
-		return image;
+		return partImage;
 	};
 
 	if (verticalEdgeLength > 0) {
-		if (insets.left > 0) {
-			CGRect partRect = CGRectMake(0, insets.bottom, insets.left, verticalEdgeLength);
+		if (pixelInsets.left > 0) {
+			CGRect partRect = CGRectMake(0, pixelInsets.bottom, pixelInsets.left, verticalEdgeLength);
 			leftEdge = imageWithRect(partRect);
 		}
 
-		if (insets.right > 0) {
-			CGRect partRect = CGRectMake(size.width - insets.right, insets.bottom, insets.right, verticalEdgeLength);
+		if (pixelInsets.right > 0) {
+			CGRect partRect = CGRectMake(size.width - pixelInsets.right, pixelInsets.bottom, pixelInsets.right, verticalEdgeLength);
 			rightEdge = imageWithRect(partRect);
 		}
 	}
 
 	if (horizontalEdgeLength > 0) {
-		if (insets.bottom > 0) {
-			CGRect partRect = CGRectMake(insets.left, 0, horizontalEdgeLength, insets.bottom);
+		if (pixelInsets.bottom > 0) {
+			CGRect partRect = CGRectMake(pixelInsets.left, 0, horizontalEdgeLength, pixelInsets.bottom);
 			bottomEdge = imageWithRect(partRect);
 		}
 
-		if (insets.top > 0) {
-			CGRect partRect = CGRectMake(insets.left, size.height - insets.top, horizontalEdgeLength, insets.top);
+		if (pixelInsets.top > 0) {
+			CGRect partRect = CGRectMake(pixelInsets.left, size.height - pixelInsets.top, horizontalEdgeLength, pixelInsets.top);
 			topEdge = imageWithRect(partRect);
 		}
 	}
 
-	if (insets.left > 0 && insets.top > 0) {
-		CGRect partRect = CGRectMake(0, size.height - insets.top, insets.left, insets.top);
+	if (pixelInsets.left > 0 && pixelInsets.top > 0) {
+		CGRect partRect = CGRectMake(0, size.height - pixelInsets.top, pixelInsets.left, pixelInsets.top);
 		topLeft = imageWithRect(partRect);
 	}
 
-	if (insets.left > 0 && insets.bottom > 0) {
-		CGRect partRect = CGRectMake(0, 0, insets.left, insets.bottom);
+	if (pixelInsets.left > 0 && pixelInsets.bottom > 0) {
+		CGRect partRect = CGRectMake(0, 0, pixelInsets.left, pixelInsets.bottom);
 		bottomLeft = imageWithRect(partRect);
 	}
 
-	if (insets.right > 0 && insets.top > 0) {
-		CGRect partRect = CGRectMake(size.width - insets.right, size.height - insets.top, insets.right, insets.top);
+	if (pixelInsets.right > 0 && pixelInsets.top > 0) {
+		CGRect partRect = CGRectMake(size.width - pixelInsets.right, size.height - pixelInsets.top, pixelInsets.right, pixelInsets.top);
 		topRight = imageWithRect(partRect);
 	}
 
-	if (insets.right > 0 && insets.bottom > 0) {
-		CGRect partRect = CGRectMake(size.width - insets.right, 0, insets.right, insets.bottom);
+	if (pixelInsets.right > 0 && pixelInsets.bottom > 0) {
+		CGRect partRect = CGRectMake(size.width - pixelInsets.right, 0, pixelInsets.right, pixelInsets.bottom);
 		bottomRight = imageWithRect(partRect);
 	}
 
-	CGRect centerRect = TUIEdgeInsetsInsetRect(CGRectMake(0, 0, size.width, size.height), insets);
+	CGRect centerRect = TUIEdgeInsetsInsetRect(CGRectMake(0, 0, size.width, size.height), pixelInsets);
 	if (centerRect.size.width > 0 && centerRect.size.height > 0) {
 		center = imageWithRect(centerRect);
 	}
 
+	return self;
+}
+
+@end
+
+@implementation TUIStretchableImage
+
+@synthesize tui_capInsets = _tui_capInsets;
+
+#pragma mark Properties
+
+- (void)setTui_capInsets:(TUIEdgeInsets)insets {
+	_tui_capInsets = insets;
+
+	// Parts sliced with the old insets will never be looked up again.
+	@synchronized (self) {
+		objc_setAssociatedObject(self, &TUIStretchableImagePartsKey, nil, OBJC_ASSOCIATION_RETAIN);
+	}
+}
+
+- (CGRect)tui_contentsCenter {
+	CGSize size = self.size;
+	if (size.width <= 0 || size.height <= 0) return CGRectMake(0, 0, 1, 1);
+
+	// Layers aren't flipped, so the bottom cap is at the origin.
+	TUIEdgeInsets insets = self.tui_capInsets;
+	CGFloat width = fmax(0, size.width - insets.left - insets.right);
+	CGFloat height = fmax(0, size.height - insets.top - insets.bottom);
+
+	return CGRectMake(insets.left / size.width, insets.bottom / size.height, width / size.width, height / size.height);
+}
+
+#pragma mark Drawing
+
+/*
+ * Returns the number of device pixels per point of the given context.
+ */
+static CGFloat TUIStretchableImageScaleOfContext(NSGraphicsContext *context) {
+	CGContextRef cgContext = context.graphicsPort;
+	if (cgContext == NULL) return 1;
+
+	CGFloat scale = fabs(CGContextConvertSizeToDeviceSpace(cgContext, CGSizeMake(1, 1)).width);
+	return scale > 0 ? scale : 1;
+}
+
+/*
+ * Returns the receiver sliced along the current cap insets for drawing at the
+ * given scale, slicing it only the first time it's drawn at that scale.
+ *
+ * The parts are kept on the receiver rather than in a shared cache, so they go
+ * away with it. They're looked up by scale rather than by the CGImage they were
+ * sliced from, since vector and multi-representation images hand out a new
+ * CGImage for every draw. This may be called from any thread drawing the image.
+ */
+- (TUIStretchableImageParts *)tui_partsForScale:(CGFloat)scale context:(NSGraphicsContext *)context hints:(NSDictionary *)hints {
+	TUIEdgeInsets insets = self.tui_capInsets;
+
+	@synchronized (self) {
+		NSMutableArray *cachedParts = objc_getAssociatedObject(self, &TUIStretchableImagePartsKey);
+		for (TUIStretchableImageParts *parts in cachedParts) {
+			if (parts->scale == scale && TUIEdgeInsetsEqualToEdgeInsets(parts->insets, insets)) return parts;
+		}
+
+		TUIStretchableImageParts *parts = [self tui_partsWithSourceRect:CGRectZero insets:insets context:context hints:hints];
+		if (parts == nil) return nil;
+
+		parts->scale = scale;
+		if (cachedParts == nil) {
+			cachedParts = [NSMutableArray arrayWithCapacity:TUIStretchableImageMaximumCachedParts];
+			objc_setAssociatedObject(self, &TUIStretchableImagePartsKey, cachedParts, OBJC_ASSOCIATION_RETAIN);
+		} else if (cachedParts.count >= TUIStretchableImageMaximumCachedParts) {
+			[cachedParts removeObjectAtIndex:0];
+		}
+
+		[cachedParts addObject:parts];
+		return parts;
+	}
+}
+
+/*
+ * Slices the given part of the receiver (all of it if srcRect is empty) along
+ * the given insets, both in points.
+ */
+- (TUIStretchableImageParts *)tui_partsWithSourceRect:(CGRect)srcRect insets:(TUIEdgeInsets)insets context:(NSGraphicsContext *)context hints:(NSDictionary *)hints {
+	CGSize size = self.size;
+	if (size.width <= 0 || size.height <= 0) return nil;
+
+	// Ask for the image at its own size, so vector images are rendered at the
+	// size the insets refer to.
+	NSRect proposedRect = NSMakeRect(0, 0, size.width, size.height);
+	CGImageRef image = [self CGImageForProposedRect:&proposedRect context:context hints:hints];
+	if (image == NULL) {
+		NSLog(@"*** Could not get CGImage of %@", self);
+		return nil;
+	}
+
+	CGFloat pixelsPerPoint = CGImageGetWidth(image) / size.width;
+	if (CGRectIsEmpty(srcRect)) {
+		return [[TUIStretchableImageParts alloc] initWithImage:image insets:insets pixelsPerPoint:pixelsPerPoint];
+	}
+
+	CGRect pixelRect = CGRectMake(srcRect.origin.x * pixelsPerPoint, srcRect.origin.y * pixelsPerPoint, srcRect.size.width * pixelsPerPoint, srcRect.size.height * pixelsPerPoint);
+	image = CGImageCreateWithImageInRect(image, CGRectIntegral(pixelRect));
+	if (!image) return nil;
+
+	// Reduce insets to account for taking only part of the original image.
+	insets.left = fmax(0, insets.left - CGRectGetMinX(srcRect));
+	insets.bottom = fmax(0, insets.bottom - CGRectGetMinY(srcRect));
+
+	CGFloat srcRightInset = size.width - CGRectGetMaxX(srcRect);
+	insets.right = fmax(0, insets.right - srcRightInset);
+
+	CGFloat srcTopInset = size.height - CGRectGetMaxY(srcRect);
+	insets.top = fmax(0, insets.top - srcTopInset);
+
+	TUIStretchableImageParts *parts = [[TUIStretchableImageParts alloc] initWithImage:image insets:insets pixelsPerPoint:pixelsPerPoint];
 	CGImageRelease(image);
+	return parts;
+}
+
+- (void)drawInRect:(NSRect)dstRect fromRect:(NSRect)srcRect operation:(NSCompositingOperation)op fraction:(CGFloat)alpha {
+	[self drawInRect:dstRect fromRect:srcRect operation:op fraction:alpha respectFlipped:YES hints:nil];
+}
+
+- (void)drawInRect:(NSRect)dstRect fromRect:(NSRect)srcRect operation:(NSCompositingOperation)op fraction:(CGFloat)alpha respectFlipped:(BOOL)respectFlipped hints:(NSDictionary *)hints {
+	NSGraphicsContext *context = [NSGraphicsContext currentContext];
+
+	TUIStretchableImageParts *parts = nil;
+	if (CGRectIsEmpty(srcRect)) {
+		// The common case of drawing the whole source image reuses the parts
+		// sliced the first time.
+		parts = [self tui_partsForScale:TUIStretchableImageScaleOfContext(context) context:context hints:hints];
+	} else {
+		parts = [self tui_partsWithSourceRect:srcRect insets:self.tui_capInsets context:context hints:hints];
+	}
+
+	if (parts == nil) return;
 
 	BOOL flipped = NO;
 	if (respectFlipped) {
-		flipped = [[NSGraphicsContext currentContext] isFlipped];
+		flipped = [context isFlipped];
 	}
 
-	if (topLeft != nil || bottomRight != nil) {
-		NSDrawNinePartImage(dstRect, bottomLeft, bottomEdge, bottomRight, leftEdge, center, rightEdge, topLeft, topEdge, topRight, op, alpha, flipped);
-	} else if (leftEdge != nil) {
+	if (parts->topLeft != nil || parts->bottomRight != nil) {
+		NSDrawNinePartImage(dstRect, parts->bottomLeft, parts->bottomEdge, parts->bottomRight, parts->leftEdge, parts->center, parts->rightEdge, parts->topLeft, parts->topEdge, parts->topRight, op, alpha, flipped);
+	} else if (parts->leftEdge != nil) {
 		// Horizontal three-part image.
-		NSDrawThreePartImage(dstRect, leftEdge, center, rightEdge, NO, op, alpha, flipped);
+		NSDrawThreePartImage(dstRect, parts->leftEdge, parts->center, parts->rightEdge, NO, op, alpha, flipped);
 	} else {
 		// Vertical three-part image.
-		NSDrawThreePartImage(dstRect, topEdge, center, bottomEdge, YES, op, alpha, flipped);
+		NSDrawThreePartImage(dstRect, parts->topEdge, parts->center, parts->bottomEdge, YES, op, alpha, flipped);
 	}
 }
 
@@ -19,6 +19,10 @@
 
 @class NSFont;
 
+/**
+ Measuring and drawing keep no shared state, so these may be called from any
+ thread, including from several threads at once.
+ */
 @interface NSAttributedString (TUIStringDrawing)
 
 - (CGSize)ab_size;
@@ -18,14 +18,21 @@
 #import "TUICGAdditions.h"
 #import "TUIStringDrawing.h"
 #import "TUITextRenderer.h"
+#import "TUITextRenderer+Private.h"
 
 @implementation NSAttributedString (TUIStringDrawing)
 
-- (TUITextRenderer *)ab_sharedTextRenderer
+static NSString *const TUIStringDrawingTextRendererKey = @"TUIStringDrawingTextRenderer";
+
+- (TUITextRenderer *)ab_threadTextRenderer
 {
-	static TUITextRenderer *t = nil;
-	if(!t)
+	// one per thread, so drawing can happen on several threads at once
+	NSMutableDictionary *threadDictionary = [[NSThread currentThread] threadDictionary];
+	TUITextRenderer *t = [threadDictionary objectForKey:TUIStringDrawingTextRendererKey];
+	if(!t) {
 		t = [[TUITextRenderer alloc] init];
+		[threadDictionary setObject:t forKey:TUIStringDrawingTextRendererKey];
+	}
 	return t;
 }
 
@@ -36,10 +43,8 @@
 
 - (CGSize)ab_sizeConstrainedToSize:(CGSize)size
 {
-	TUITextRenderer *t = [self ab_sharedTextRenderer];
-	t.attributedString = self;
-	t.frame = CGRectMake(0, 0, size.width, size.height);
-	return [t size];
+	// the layout cache is shared by all threads, so this is safe to call from any of them
+	return [TUITextRenderer sizeOfAttributedString:self constrainedToSize:size];
 }
 
 - (CGSize)ab_size
@@ -49,11 +54,13 @@
 
 - (CGSize)ab_drawInRect:(CGRect)rect context:(CGContextRef)ctx
 {
-	TUITextRenderer *t = [self ab_sharedTextRenderer];
+	TUITextRenderer *t = [self ab_threadTextRenderer];
 	t.attributedString = self;
 	t.frame = rect;
 	[t drawInContext:ctx];
-	return [t size];
+	CGSize s = [t size];
+	t.attributedString = nil; // don't hold on to the string or its layout
+	return s;
 }
 
 - (CGSize)ab_drawInRect:(CGRect)rect
@@ -23,7 +23,12 @@
 	TUITableViewCell *cell = [self dequeueReusableCellWithIdentifier:identifier];
 	if(!cell) {
 		cell = [[cellClass alloc] initWithStyle:TUITableViewCellStyleDefault reuseIdentifier:identifier];
-		if(block != nil) block(cell);
+		if(block != nil) {
+			block(cell);
+		} else {
+			// cells which need no further setup can be prewarmed
+			[self registerClass:cellClass forCellReuseIdentifier:identifier];
+		}
 	}
 	return cell;
 }
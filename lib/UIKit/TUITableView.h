@@ -37,6 +37,9 @@ typedef enum {
 
 @class TUITableViewCell;
 @protocol TUITableViewDataSource;
+@protocol TUITableViewDataSourcePrefetching;
+
+typedef CGFloat (^TUITableViewRowHeightProvider)(NSIndexPath *indexPath);
 
 @class TUITableView;
 
@@ -46,6 +49,9 @@ typedef enum {
 
 @optional
 
+// if implemented, -tableView:heightForRowAtIndexPath: is only called for rows as they come near the visible area. see -[TUITableView estimatedRowHeight]
+- (CGFloat)tableView:(TUITableView *)tableView estimatedHeightForRowAtIndexPath:(NSIndexPath *)indexPath;
+
 - (void)tableView:(TUITableView *)tableView willDisplayCell:(TUITableViewCell *)cell forRowAtIndexPath:(NSIndexPath *)indexPath; // called after the cell's frame has been set but before it's added as a subview
 - (void)tableView:(TUITableView *)tableView didSelectRowAtIndexPath:(NSIndexPath *)indexPath; // happens on left/right mouse down, key up/down
 - (void)tableView:(TUITableView *)tableView didDeselectRowAtIndexPath:(NSIndexPath *)indexPath;
@@ -54,6 +60,9 @@ typedef enum {
 - (BOOL)tableView:(TUITableView*)tableView shouldSelectRowAtIndexPath:(NSIndexPath*)indexPath forEvent:(NSEvent*)event; // YES, if not implemented
 - (NSMenu *)tableView:(TUITableView *)tableView menuForRowAtIndexPath:(NSIndexPath *)indexPath withEvent:(NSEvent *)event;
 
+// called on the main thread as batches of row heights from -[TUITableView backgroundRowHeightProvider] are published
+- (void)tableView:(TUITableView *)tableView didPrecomputeHeightsForRows:(NSUInteger)count ofTotal:(NSUInteger)total;
+
 // the following are good places to update or restore state (such as selection) when the table data reloads
 - (void)tableViewWillReloadData:(TUITableView *)tableView;
 - (void)tableViewDidReloadData:(TUITableView *)tableView;
@@ -77,13 +86,41 @@ typedef enum {
 	
 	NSMutableIndexSet           * _visibleSectionHeaders;
 	NSMutableDictionary         * _visibleItems;
+	NSIndexPath                 * _firstVisibleIndexPath; // range of rows with cells in _visibleItems
+	NSIndexPath                 * _lastVisibleIndexPath;
 	NSMutableDictionary         * _reusableTableCells;
+	NSMutableDictionary         * _registeredCellClasses;
+	NSMutableDictionary         * _maximumReusableCellCounts;
+	NSMutableDictionary         * _prewarmCellCounts;
+	NSUInteger                    _maximumReusableCellCount;
 	
 	NSIndexPath            * _selectedIndexPath;
 	NSIndexPath            * _indexPathShouldBeFirstResponder;
 	NSInteger                     _futureMakeFirstResponderToken;
 	NSIndexPath            * _keepVisibleIndexPathForReload;
 	CGFloat                       _relativeOffsetForReload;
+	CGFloat                       _estimatedRowHeight;
+	CGFloat                       _defaultEstimatedRowHeight;
+	
+	// batch update state
+	NSUInteger                    _updateNestingLevel;
+	NSMutableArray              * _updateDeletedIndexPaths;
+	NSMutableArray              * _updateInsertedIndexPaths;
+	NSMutableArray              * _updateMovedIndexPaths;
+	
+	// background row height state
+	TUITableViewRowHeightProvider _backgroundRowHeightProvider;
+	NSUInteger                    _rowHeightGeneration;
+	id                            _rowHeightPrecomputation; // cancelled when a new generation starts
+	NSUInteger                    _precomputedRowCount;
+	NSUInteger                    _precomputeRowTotal;
+	
+	// prefetching state
+	__unsafe_unretained id <TUITableViewDataSourcePrefetching> _prefetchDataSource; // weak
+	NSUInteger                    _prefetchScreenCount;
+	NSMutableSet                * _prefetchedIndexPaths;
+	CGFloat                       _lastPrefetchVisibleOrigin;
+	BOOL                          _prefetchingTowardsTop;
 	
 	// drag-to-reorder state
   TUITableViewCell            * _dragToReorderCell;
@@ -103,6 +140,8 @@ typedef enum {
 		unsigned int dataSourceNumberOfSectionsInTableView:1;
 		unsigned int delegateTableViewWillDisplayCellForRowAtIndexPath:1;
 		unsigned int maintainContentOffsetAfterReload:1;
+		unsigned int usesEstimatedRowHeights:1;
+		unsigned int visibleCellsNeedRelayout:1;
 	} _tableFlags;
 	
 }
@@ -112,9 +151,29 @@ typedef enum {
 @property (nonatomic,unsafe_unretained) id <TUITableViewDataSource>  dataSource;
 @property (nonatomic,unsafe_unretained) id <TUITableViewDelegate>    delegate;
 
+/**
+ Told about rows which are likely to become visible soon, based on the direction and speed of scrolling, so it can warm caches before the cells are requested. Rows which are no longer expected (for instance because the scroll direction reversed) are cancelled.
+ */
+@property (nonatomic,unsafe_unretained) id <TUITableViewDataSourcePrefetching> prefetchDataSource;
+
+/**
+ How many screens of rows ahead of the visible area to prefetch. Default is 1.
+ */
+@property (nonatomic, assign) NSUInteger prefetchScreenCount;
+
 @property (readwrite, assign) BOOL                        animateSelectionChanges;
 @property (nonatomic, assign) BOOL maintainContentOffsetAfterReload;
 
+/**
+ When greater than zero (or when the delegate implements -tableView:estimatedHeightForRowAtIndexPath:) rows are laid out using an estimated height and -tableView:heightForRowAtIndexPath: is only called for rows as they come near the visible area. Content size and offsets are corrected as rows are measured, keeping the visible content in place. Default is 0.
+ */
+@property (nonatomic, assign) CGFloat estimatedRowHeight;
+
+/**
+ When set, row heights are computed by calling this block in parallel batches on a background queue after each reload, and published to the table as each batch completes. Rows use their estimated height (see estimatedRowHeight, or the height of the first row if there is no estimate) until then; rows near the visible area are still measured on the main thread with -tableView:heightForRowAtIndexPath:. The block must be thread safe and must return the same heights as the delegate. Set it before the table is loaded.
+ */
+@property (nonatomic, copy) TUITableViewRowHeightProvider backgroundRowHeightProvider;
+
 - (void)reloadData;
 
 /**
@@ -122,6 +181,16 @@ typedef enum {
  */
 - (void)reloadDataMaintainingVisibleIndexPath:(NSIndexPath *)indexPath relativeOffset:(CGFloat)relativeOffset;
 
+/**
+ Row insertions, deletions and moves made between -beginUpdates and -endUpdates are applied together when the outermost -endUpdates is called; outside of such a block they are applied immediately. Deleted and moved-from index paths refer to rows before the update, inserted and moved-to index paths to rows after it, and the data source must already reflect the update. Unlike -reloadData, only the affected sections are recalculated, visible cells of surviving rows are kept, and the topmost visible row stays in place.
+ */
+- (void)beginUpdates;
+- (void)endUpdates;
+
+- (void)insertRowsAtIndexPaths:(NSArray *)indexPaths;
+- (void)deleteRowsAtIndexPaths:(NSArray *)indexPaths;
+- (void)moveRowAtIndexPath:(NSIndexPath *)indexPath toIndexPath:(NSIndexPath *)newIndexPath;
+
 // Forces a re-calculation and re-layout of the table. This is most useful for animating the relayout. It is potentially _more_ expensive than -reloadData since it has to allow for animating.
 - (void)reloadLayout;
 
@@ -174,6 +243,29 @@ typedef enum {
  */
 - (TUITableViewCell *)dequeueReusableCellWithIdentifier:(NSString *)identifier;
 
+/**
+ Registers the class used to create cells for @p identifier when prewarming. -ab_reusableCellOfClass:identifier:initializationBlock: registers its class automatically when it has no initialization block.
+ */
+- (void)registerClass:(Class)cellClass forCellReuseIdentifier:(NSString *)identifier;
+
+/**
+ Creates cells for a registered identifier while the run loop is idle, until @p count cells are waiting to be reused, so the first scroll doesn't have to allocate them. The reuse pool for the identifier holds at least @p count cells from then on.
+ */
+- (void)prewarmCellsWithIdentifier:(NSString *)identifier count:(NSUInteger)count;
+
+/**
+ The number of cells kept for reuse per identifier. Cells enqueued beyond this are released, and pools are trimmed back to it after every layout. When 0 (the default) the limit is the number of visible cells, but at least a few.
+ */
+@property (nonatomic, assign) NSUInteger maximumReusableCellCount;
+
+// overrides maximumReusableCellCount for one identifier; pass 0 to go back to the default
+- (void)setMaximumReusableCellCount:(NSUInteger)count forIdentifier:(NSString *)identifier;
+
+/**
+ Releases all cells waiting to be reused. Called automatically when the system is under memory pressure.
+ */
+- (void)purgeReusableCells;
+
 @end
 
 @protocol TUITableViewDataSource<NSObject>
@@ -199,6 +291,20 @@ typedef enum {
 
 @end
 
+@protocol TUITableViewDataSourcePrefetching <NSObject>
+
+@required
+
+// rows are ordered in the direction of scrolling; may be called for rows which were cancelled before
+- (void)tableView:(TUITableView *)tableView prefetchRowsAtIndexPaths:(NSArray *)indexPaths;
+
+@optional
+
+// rows which were prefetched but are no longer expected to become visible
+- (void)tableView:(TUITableView *)tableView cancelPrefetchingForRowsAtIndexPaths:(NSArray *)indexPaths;
+
+@end
+
 @interface NSIndexPath (TUITableView)
 
 + (NSIndexPath *)indexPathForRow:(NSUInteger)row inSection:(NSUInteger)section;
@@ -19,15 +19,48 @@
 #import "TUINSWindow.h"
 #import "TUITableView+Cell.h"
 #import "TUITableViewSectionHeader.h"
+#import <libkern/OSAtomic.h>
 
 // header views need to be above the cells at all times
 #define HEADER_Z_POSITION 1000 
 
+// number of rows computed together by the background row height provider
+#define ROW_HEIGHT_PRECOMPUTE_BATCH_SIZE 512
+
+// number of rows a background batch computes between checks for cancellation
+#define ROW_HEIGHT_PRECOMPUTE_CANCEL_CHECK_INTERVAL 32
+
+// how far ahead (in seconds of throw velocity) to prefetch rows when throwing
+#define PREFETCH_THROW_LOOKAHEAD 0.5
+
+// the least number of cells kept for reuse per identifier by default
+#define MINIMUM_REUSABLE_CELL_COUNT 8
+
+// number of cells created per idle run loop pass when prewarming
+#define PREWARM_CELLS_PER_PASS 4
+
+static NSString * const TUITableViewPurgeReusableCellsNotification = @"TUITableViewPurgeReusableCellsNotification";
+
 typedef struct {
 	CGFloat offset; // from beginning of section
 	CGFloat height;
+	BOOL    estimated; // height is an estimate, the row has not been measured yet
 } TUITableViewRowInfo;
 
+@interface TUITableView (Private)
+- (void)_updateSectionInfo;
+- (CGFloat)_defaultEstimatedRowHeight;
+- (void)_updateDerepeaterViews;
+- (void)_applyRowUpdatesDeleting:(NSArray *)deleted inserting:(NSArray *)inserted moving:(NSArray *)moved;
+- (void)_precomputeRowHeights;
+- (void)_publishPrecomputedRowHeights:(const CGFloat *)heights range:(NSRange)range inSection:(NSInteger)s generation:(NSUInteger)generation;
+- (void)_updateOffsetsFromSection:(NSInteger)firstChangedSection heightChangeAboveVisibleRect:(CGFloat)delta;
+- (void)_updatePrefetchingForVisibleRect:(CGRect)visible;
+- (void)_cancelAllPrefetching;
+- (NSInteger)_indexOfFirstSectionEndingAtOrAfterOffset:(CGFloat)offset;
+- (void)_enumerateRowsFromOffset:(CGFloat)minOffset toOffset:(CGFloat)maxOffset usingBlock:(void (^)(NSInteger section, NSInteger row, BOOL *stop))block;
+@end
+
 @interface TUITableViewSection : NSObject
 {
 	__unsafe_unretained TUITableView  *_tableView;   // weak
@@ -37,6 +70,7 @@ typedef struct {
 	CGFloat               sectionHeight;
 	CGFloat               sectionOffset;
 	TUITableViewRowInfo  *rowInfo;
+	NSUInteger            firstInvalidRowOffset; // rows from here on need their offsets recomputed
 }
 
 @property (strong, readonly) TUIView           *headerView;
@@ -57,6 +91,7 @@ typedef struct {
 		sectionIndex = s;
 		numberOfRows = n;
 		rowInfo = calloc(n, sizeof(TUITableViewRowInfo));
+		firstInvalidRowOffset = NSNotFound;
 	}
 	return self;
 }
@@ -71,24 +106,196 @@ typedef struct {
 	return numberOfRows;
 }
 
-- (void)_setupRowHeights
+/**
+ * @brief Calculate row heights and offsets
+ * 
+ * When @p estimate is true, rows are given an estimated height (from the
+ * delegate if it implements tableView:estimatedHeightForRowAtIndexPath:, or the
+ * table view's default estimate otherwise) and are not measured until
+ * #_measureRow: is called for them. Rows without a positive estimate are
+ * measured right away.
+ * 
+ * @param estimate whether row heights should be estimated
+ */
+- (void)_setupRowHeightsUsingEstimates:(BOOL)estimate
 {
 	sectionHeight = 0.0;
+	firstInvalidRowOffset = NSNotFound;
 	
 	TUIView *header;
 	if((header = self.headerView) != nil) {
 		sectionHeight += roundf(header.frame.size.height);
 	}
-  
+	
+	id<TUITableViewDelegate> delegate = _tableView.delegate;
+	BOOL delegateEstimates = estimate && [delegate respondsToSelector:@selector(tableView:estimatedHeightForRowAtIndexPath:)];
+	CGFloat estimatedRowHeight = [_tableView _defaultEstimatedRowHeight];
+	
 	for(int i = 0; i < numberOfRows; ++i) {
-		CGFloat h = roundf([_tableView.delegate tableView:_tableView heightForRowAtIndexPath:[NSIndexPath indexPathForRow:i inSection:sectionIndex]]);
+		CGFloat h = 0.0;
+		if(delegateEstimates) {
+			h = roundf([delegate tableView:_tableView estimatedHeightForRowAtIndexPath:[NSIndexPath indexPathForRow:i inSection:sectionIndex]]);
+		}
+		if(estimate && h <= 0.0) {
+			h = estimatedRowHeight;
+		}
+		BOOL estimated = (estimate && h > 0.0);
+		if(!estimated) {
+			h = roundf([delegate tableView:_tableView heightForRowAtIndexPath:[NSIndexPath indexPathForRow:i inSection:sectionIndex]]);
+		}
 		rowInfo[i].offset = sectionHeight;
 		rowInfo[i].height = h;
+		rowInfo[i].estimated = estimated;
 		sectionHeight += h;
 	}
 	
 }
 
+- (BOOL)isRowHeightEstimated:(NSInteger)i
+{
+	if(i >= 0 && i < numberOfRows) {
+		return rowInfo[i].estimated;
+	}
+	return NO;
+}
+
+/**
+ * @brief Replace the estimated height of a row with its real height
+ * 
+ * Offsets of the following rows are not updated until #_updateRowOffsets is
+ * called, so several rows can be measured before paying for the fixup.
+ * 
+ * @param i the row
+ * @return the difference between the real and the estimated height
+ */
+- (CGFloat)_measureRow:(NSInteger)i
+{
+	if(i < 0 || i >= numberOfRows || !rowInfo[i].estimated) {
+		return 0.0;
+	}
+	
+	CGFloat h = [_tableView.delegate tableView:_tableView heightForRowAtIndexPath:[NSIndexPath indexPathForRow:i inSection:sectionIndex]];
+	return [self _setMeasuredHeight:h forRow:i];
+}
+
+- (BOOL)hasEstimatedRowsInRange:(NSRange)range
+{
+	for(NSUInteger i = range.location; i < NSMaxRange(range) && i < numberOfRows; ++i) {
+		if(rowInfo[i].estimated) return YES;
+	}
+	return NO;
+}
+
+/**
+ * @brief Replace the estimated height of a row with a height measured elsewhere
+ * 
+ * @param height the real height of the row
+ * @param i the row
+ * @return the difference between the real and the estimated height
+ */
+- (CGFloat)_setMeasuredHeight:(CGFloat)height forRow:(NSInteger)i
+{
+	if(i < 0 || i >= numberOfRows || !rowInfo[i].estimated) {
+		return 0.0;
+	}
+	
+	CGFloat h = roundf(height);
+	CGFloat delta = h - rowInfo[i].height;
+	rowInfo[i].height = h;
+	rowInfo[i].estimated = NO;
+	
+	if(delta != 0.0 && i < firstInvalidRowOffset) {
+		firstInvalidRowOffset = i;
+	}
+	
+	return delta;
+}
+
+/**
+ * @brief Recompute row offsets and the section height after rows were measured
+ */
+- (void)_updateRowOffsets
+{
+	if(firstInvalidRowOffset >= numberOfRows) {
+		return;
+	}
+	
+	CGFloat offset = rowInfo[firstInvalidRowOffset].offset;
+	for(NSUInteger i = firstInvalidRowOffset; i < numberOfRows; ++i) {
+		rowInfo[i].offset = offset;
+		offset += rowInfo[i].height;
+	}
+	
+	sectionHeight = offset;
+	firstInvalidRowOffset = NSNotFound;
+}
+
+/**
+ * @brief Obtain the row info for a row which is new to this section
+ * 
+ * The section's own row info is not modified, so this can be used while the
+ * new row info for a batch update is being assembled.
+ * 
+ * @param i the row, in the section as it will be after the update
+ * @param estimate whether the row height should be estimated
+ * @return row info with a zero offset
+ */
+- (TUITableViewRowInfo)_rowInfoForNewRow:(NSInteger)i usingEstimates:(BOOL)estimate
+{
+	TUITableViewRowInfo info;
+	NSIndexPath *indexPath = [NSIndexPath indexPathForRow:i inSection:sectionIndex];
+	id<TUITableViewDelegate> delegate = _tableView.delegate;
+	
+	info.height = 0.0;
+	if(estimate && [delegate respondsToSelector:@selector(tableView:estimatedHeightForRowAtIndexPath:)]) {
+		info.height = roundf([delegate tableView:_tableView estimatedHeightForRowAtIndexPath:indexPath]);
+	}
+	if(estimate && info.height <= 0.0) {
+		info.height = [_tableView _defaultEstimatedRowHeight];
+	}
+	
+	info.offset = 0.0;
+	info.estimated = (estimate && info.height > 0.0);
+	if(!info.estimated) {
+		info.height = roundf([delegate tableView:_tableView heightForRowAtIndexPath:indexPath]);
+	}
+	return info;
+}
+
+- (TUITableViewRowInfo)rowInfoAtIndex:(NSInteger)i
+{
+	return rowInfo[i];
+}
+
+/**
+ * @brief Replace the rows of this section
+ * 
+ * The section takes ownership of @p info, which must have been allocated
+ * with malloc. Row offsets and the section height are recomputed.
+ * 
+ * @param info row info for the new rows
+ * @param n the new number of rows
+ */
+- (void)_replaceRowInfo:(TUITableViewRowInfo *)info numberOfRows:(NSUInteger)n
+{
+	if(rowInfo) free(rowInfo);
+	rowInfo = info;
+	numberOfRows = n;
+	
+	sectionHeight = 0.0;
+	TUIView *header;
+	if((header = self.headerView) != nil) {
+		sectionHeight += roundf(header.frame.size.height);
+	}
+	
+	for(NSUInteger i = 0; i < numberOfRows; ++i) {
+		rowInfo[i].offset = sectionHeight;
+		sectionHeight += rowInfo[i].height;
+	}
+	
+	firstInvalidRowOffset = NSNotFound;
+}
+
 - (CGFloat)rowHeight:(NSInteger)i
 {
 	if(i >= 0 && i < numberOfRows) {
@@ -110,6 +317,31 @@ typedef struct {
 	return sectionOffset + [self sectionRowOffset:i];
 }
 
+/**
+ * @brief Obtain the first row which ends at or after the specified offset
+ *
+ * Row offsets are cumulative and therefore sorted, so the row can be found
+ * with a binary search over the row info array.
+ *
+ * @param offset offset from the beginning of the section
+ * @return index of the first row ending at or after @p offset, or the number
+ * of rows if there is no such row
+ */
+- (NSInteger)indexOfFirstRowEndingAtOrAfterOffset:(CGFloat)offset
+{
+	NSInteger low = 0;
+	NSInteger high = numberOfRows;
+	while(low < high) {
+		NSInteger mid = low + (high - low) / 2;
+		if(rowInfo[mid].offset + rowInfo[mid].height < offset) {
+			low = mid + 1;
+		} else {
+			high = mid;
+		}
+	}
+	return low;
+}
+
 - (CGFloat)sectionHeight
 {
 	return sectionHeight;
@@ -142,28 +374,85 @@ typedef struct {
 
 @end
 
-@interface TUITableView (Private)
-- (void)_updateSectionInfo;
-- (void)_updateDerepeaterViews;
+/*
+ * Shared by the table with the background batches of one generation of row
+ * heights, which stop once it's cancelled because the rows have changed.
+ */
+@interface TUITableViewRowHeightPrecomputation : NSObject
+{
+	@public
+	volatile int32_t cancelled;
+}
+@end
+
+@implementation TUITableViewRowHeightPrecomputation
 @end
 
+static void TUITableViewCancelRowHeightPrecomputation(TUITableViewRowHeightPrecomputation *precomputation)
+{
+	if(precomputation)
+		OSAtomicCompareAndSwap32Barrier(0, 1, &precomputation->cancelled);
+}
+
+static BOOL TUITableViewRowHeightPrecomputationIsCancelled(TUITableViewRowHeightPrecomputation *precomputation)
+{
+	return OSAtomicAdd32Barrier(0, &precomputation->cancelled) != 0;
+}
+
 @implementation TUITableView
 
 @synthesize pullDownView=_pullDownView;
 @synthesize headerView=_headerView;
+@synthesize estimatedRowHeight=_estimatedRowHeight;
+@synthesize backgroundRowHeightProvider=_backgroundRowHeightProvider;
+@synthesize prefetchDataSource=_prefetchDataSource;
+@synthesize prefetchScreenCount=_prefetchScreenCount;
+@synthesize maximumReusableCellCount=_maximumReusableCellCount;
+
++ (void)initialize
+{
+	if(self != [TUITableView class])
+		return;
+	
+	// drop reusable cells in every table view when the system is low on memory
+#ifdef DISPATCH_SOURCE_TYPE_MEMORYPRESSURE
+	if(DISPATCH_SOURCE_TYPE_MEMORYPRESSURE != NULL) {
+		static dispatch_source_t memoryPressureSource;
+		memoryPressureSource = dispatch_source_create(DISPATCH_SOURCE_TYPE_MEMORYPRESSURE, 0, DISPATCH_MEMORYPRESSURE_WARN | DISPATCH_MEMORYPRESSURE_CRITICAL, dispatch_get_main_queue());
+		dispatch_source_set_event_handler(memoryPressureSource, ^{
+			[[NSNotificationCenter defaultCenter] postNotificationName:TUITableViewPurgeReusableCellsNotification object:nil];
+		});
+		dispatch_resume(memoryPressureSource);
+	}
+#endif
+}
 
 - (id)initWithFrame:(CGRect)frame style:(TUITableViewStyle)style
 {
 	if((self = [super initWithFrame:frame])) {
 		_style = style;
 		_reusableTableCells = [[NSMutableDictionary alloc] init];
+		_registeredCellClasses = [[NSMutableDictionary alloc] init];
+		_maximumReusableCellCounts = [[NSMutableDictionary alloc] init];
+		_prewarmCellCounts = [[NSMutableDictionary alloc] init];
 		_visibleSectionHeaders = [[NSMutableIndexSet alloc] init];
 		_visibleItems = [[NSMutableDictionary alloc] init];
+		_prefetchedIndexPaths = [[NSMutableSet alloc] init];
+		_prefetchScreenCount = 1;
 		_tableFlags.animateSelectionChanges = 1;
+		
+		[[NSNotificationCenter defaultCenter] addObserver:self selector:@selector(purgeReusableCells) name:TUITableViewPurgeReusableCellsNotification object:nil];
 	}
 	return self;
 }
 
+- (void)dealloc
+{
+	TUITableViewCancelRowHeightPrecomputation(_rowHeightPrecomputation);
+	[NSObject cancelPreviousPerformRequestsWithTarget:self selector:@selector(_prewarmCells) object:nil];
+	[[NSNotificationCenter defaultCenter] removeObserver:self];
+}
+
 - (id)initWithFrame:(CGRect)frame
 {
 	return [self initWithFrame:frame style:TUITableViewStylePlain];
@@ -278,19 +567,254 @@ typedef struct {
 	}
 	
 	NSMutableArray *sections = [[NSMutableArray alloc] initWithCapacity:numberOfSections];
-	
-	CGFloat offset = [_headerView bounds].size.height - self.contentInset.top*2;
 	for(int s = 0; s < numberOfSections; ++s) {
 		TUITableViewSection *section = [[TUITableViewSection alloc] initWithNumberOfRows:[_dataSource tableView:self numberOfRowsInSection:s] sectionIndex:s tableView:self];
-		[section _setupRowHeights];
+		[sections addObject:section];
+	}
+	
+	// with only a background row height provider there is no estimate to lay
+	// rows out with until their heights come back, so the first row stands in
+	_defaultEstimatedRowHeight = roundf(_estimatedRowHeight);
+	if(_defaultEstimatedRowHeight <= 0.0 && _backgroundRowHeightProvider != nil) {
+		for(TUITableViewSection *section in sections) {
+			if([section numberOfRows] > 0) {
+				_defaultEstimatedRowHeight = roundf([self.delegate tableView:self heightForRowAtIndexPath:[NSIndexPath indexPathForRow:0 inSection:section.sectionIndex]]);
+				break;
+			}
+		}
+	}
+	
+	_tableFlags.usesEstimatedRowHeights = (_defaultEstimatedRowHeight > 0.0 || [self.delegate respondsToSelector:@selector(tableView:estimatedHeightForRowAtIndexPath:)]);
+	
+	CGFloat offset = [_headerView bounds].size.height - self.contentInset.top*2;
+	for(TUITableViewSection *section in sections) {
+		[section _setupRowHeightsUsingEstimates:_tableFlags.usesEstimatedRowHeights];
 		section.sectionOffset = offset;
 		offset += [section sectionHeight];
-		[sections addObject:section];
 	}
 	
 	_contentHeight = offset - self.contentInset.bottom;
 	_sectionInfo = sections;
 	
+	[self _precomputeRowHeights];
+	
+}
+
+/**
+ * @brief Obtain the estimated height of rows without an estimate of their own
+ * 
+ * This is the estimatedRowHeight, or the height of the first row if only a
+ * background row height provider is set. Zero means rows are measured.
+ */
+- (CGFloat)_defaultEstimatedRowHeight
+{
+	return _defaultEstimatedRowHeight;
+}
+
+/**
+ * @brief Compute estimated row heights in the background
+ * 
+ * If a #backgroundRowHeightProvider is set, rows which still have estimated
+ * heights are split into batches which are computed concurrently on a global
+ * queue. Each batch is published on the main thread as it completes. A
+ * reload or row update cancels the batches of the previous generation, which
+ * stop computing at their next check; any still published are discarded on
+ * the main thread, where the generation is read and written.
+ */
+- (void)_precomputeRowHeights
+{
+	NSUInteger generation = ++_rowHeightGeneration;
+	_precomputedRowCount = 0;
+	_precomputeRowTotal = 0;
+	
+	TUITableViewCancelRowHeightPrecomputation(_rowHeightPrecomputation);
+	_rowHeightPrecomputation = nil;
+	
+	if(_backgroundRowHeightProvider == nil || !_tableFlags.usesEstimatedRowHeights)
+		return;
+	
+	TUITableViewRowHeightProvider provider = _backgroundRowHeightProvider;
+	TUITableViewRowHeightPrecomputation *precomputation = [[TUITableViewRowHeightPrecomputation alloc] init];
+	_rowHeightPrecomputation = precomputation;
+	__weak TUITableView *weakSelf = self;
+	dispatch_queue_t queue = dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_LOW, 0);
+	
+	NSInteger numberOfSections = [_sectionInfo count];
+	for(NSInteger s = 0; s < numberOfSections; ++s) {
+		TUITableViewSection *section = [_sectionInfo objectAtIndex:s];
+		NSUInteger numberOfRows = [section numberOfRows];
+		for(NSUInteger start = 0; start < numberOfRows; start += ROW_HEIGHT_PRECOMPUTE_BATCH_SIZE) {
+			NSRange range = NSMakeRange(start, MIN(ROW_HEIGHT_PRECOMPUTE_BATCH_SIZE, numberOfRows - start));
+			if(![section hasEstimatedRowsInRange:range])
+				continue;
+			
+			_precomputeRowTotal += range.length;
+			dispatch_async(queue, ^{
+				CGFloat *heights = malloc(range.length * sizeof(CGFloat));
+				@autoreleasepool {
+					for(NSUInteger i = 0; i < range.length; ++i) {
+						if(i % ROW_HEIGHT_PRECOMPUTE_CANCEL_CHECK_INTERVAL == 0 && TUITableViewRowHeightPrecomputationIsCancelled(precomputation)) {
+							free(heights);
+							return;
+						}
+						heights[i] = provider([NSIndexPath indexPathForRow:range.location + i inSection:s]);
+					}
+				}
+				
+				dispatch_async(dispatch_get_main_queue(), ^{
+					[weakSelf _publishPrecomputedRowHeights:heights range:range inSection:s generation:generation];
+					free(heights);
+				});
+			});
+		}
+	}
+}
+
+/**
+ * @brief Publish a batch of row heights computed in the background
+ * 
+ * Rows which have been measured in the meantime keep their height. Offsets
+ * are fixed up the same way as for rows measured during layout.
+ */
+- (void)_publishPrecomputedRowHeights:(const CGFloat *)heights range:(NSRange)range inSection:(NSInteger)s generation:(NSUInteger)generation
+{
+	if(generation != _rowHeightGeneration || s >= [_sectionInfo count])
+		return;
+	
+	TUITableViewSection *section = [_sectionInfo objectAtIndex:s];
+	CGFloat visibleTopOffset = _contentHeight - CGRectGetMaxY([self visibleRect]);
+	CGFloat deltaAboveVisible = 0.0;
+	BOOL changed = NO;
+	
+	for(NSUInteger i = 0; i < range.length; ++i) {
+		NSInteger row = range.location + i;
+		BOOL aboveVisible = ([section tableRowOffset:row] + [section rowHeight:row] <= visibleTopOffset);
+		CGFloat delta = [section _setMeasuredHeight:heights[i] forRow:row];
+		if(delta != 0.0) {
+			changed = YES;
+			if(aboveVisible) deltaAboveVisible += delta;
+		}
+	}
+	
+	if(changed) {
+		[self _updateOffsetsFromSection:s heightChangeAboveVisibleRect:deltaAboveVisible];
+		_tableFlags.visibleCellsNeedRelayout = 1;
+		[self setNeedsLayout];
+	}
+	
+	_precomputedRowCount += range.length;
+	if([self.delegate respondsToSelector:@selector(tableView:didPrecomputeHeightsForRows:ofTotal:)]) {
+		[self.delegate tableView:self didPrecomputeHeightsForRows:_precomputedRowCount ofTotal:_precomputeRowTotal];
+	}
+}
+
+/**
+ * @brief Measure rows whose heights are still estimated between two offsets
+ * 
+ * Offsets are measured from the top of the table content. Once the rows are
+ * measured, row and section offsets are fixed up from the first section that
+ * changed and the content offset is adjusted by the height change above the
+ * visible area, so the visible content does not move.
+ * 
+ * @param minOffset the offset to begin measuring at
+ * @param maxOffset the offset to stop measuring at
+ * @return YES if any row was measured
+ */
+- (BOOL)_measureEstimatedRowsFromOffset:(CGFloat)minOffset toOffset:(CGFloat)maxOffset
+{
+	if(!_tableFlags.usesEstimatedRowHeights)
+		return NO;
+	
+	CGRect visible = [self visibleRect];
+	CGFloat visibleTopOffset = _contentHeight - CGRectGetMaxY(visible);
+	
+	__block BOOL measured = NO;
+	__block CGFloat deltaAboveVisible = 0.0;
+	__block NSInteger firstChangedSection = NSNotFound;
+	[self _enumerateRowsFromOffset:minOffset toOffset:maxOffset usingBlock:^(NSInteger s, NSInteger row, BOOL *stop) {
+		TUITableViewSection *section = [_sectionInfo objectAtIndex:s];
+		if(![section isRowHeightEstimated:row])
+			return;
+		
+		BOOL aboveVisible = ([section tableRowOffset:row] + [section rowHeight:row] <= visibleTopOffset);
+		CGFloat delta = [section _measureRow:row];
+		measured = YES;
+		
+		if(delta != 0.0) {
+			if(aboveVisible) deltaAboveVisible += delta;
+			if(firstChangedSection == NSNotFound) firstChangedSection = s;
+		}
+	}];
+	
+	if(firstChangedSection != NSNotFound) {
+		[self _updateOffsetsFromSection:firstChangedSection heightChangeAboveVisibleRect:deltaAboveVisible];
+	}
+	
+	return measured;
+}
+
+/**
+ * @brief Fix up row and section offsets after row heights changed
+ * 
+ * The content offset is adjusted by the height change above the visible
+ * area, so the visible content does not move.
+ * 
+ * @param firstChangedSection the first section with a changed row height
+ * @param delta the total height change of rows above the visible area
+ */
+- (void)_updateOffsetsFromSection:(NSInteger)firstChangedSection heightChangeAboveVisibleRect:(CGFloat)delta
+{
+	CGFloat previousTop = self.contentSize.height + self.contentOffset.y;
+	
+	NSInteger numberOfSections = [_sectionInfo count];
+	CGFloat offset = [[_sectionInfo objectAtIndex:firstChangedSection] sectionOffset];
+	for(NSInteger s = firstChangedSection; s < numberOfSections; ++s) {
+		TUITableViewSection *section = [_sectionInfo objectAtIndex:s];
+		[section _updateRowOffsets];
+		section.sectionOffset = offset;
+		offset += [section sectionHeight];
+	}
+	
+	_contentHeight = offset - self.contentInset.bottom;
+	self.contentSize = CGSizeMake(self.bounds.size.width, _contentHeight);
+	self.contentOffset = CGPointMake(self.contentOffset.x, previousTop + delta - self.contentSize.height);
+}
+
+/**
+ * @brief Measure estimated rows in and around the visible area
+ * 
+ * Measured rows may be shorter than their estimates, which pulls more rows
+ * into the area, so this repeats until every row near the visible area has
+ * its real height.
+ * 
+ * @return YES if any row was measured
+ */
+- (BOOL)_measureEstimatedRowsNearVisibleRect
+{
+	BOOL measured = NO;
+	
+	while(_tableFlags.usesEstimatedRowHeights) {
+		CGRect visible = [self visibleRect];
+		CGFloat margin = visible.size.height;
+		CGFloat minOffset = _contentHeight - CGRectGetMaxY(visible) - margin;
+		CGFloat maxOffset = _contentHeight - CGRectGetMinY(visible) + margin;
+		if(![self _measureEstimatedRowsFromOffset:minOffset toOffset:maxOffset])
+			break;
+		measured = YES;
+	}
+	
+	return measured;
+}
+
+/**
+ * @brief Obtain the number of cells kept for reuse for an identifier
+ */
+- (NSUInteger)_maximumReusableCellCountForIdentifier:(NSString *)identifier
+{
+	NSUInteger count = [[_maximumReusableCellCounts objectForKey:identifier] unsignedIntegerValue];
+	if(count == 0) count = _maximumReusableCellCount;
+	if(count == 0) count = MAX([_visibleItems count], MINIMUM_REUSABLE_CELL_COUNT);
+	return MAX(count, [[_prewarmCellCounts objectForKey:identifier] unsignedIntegerValue]);
 }
 
 - (void)_enqueueReusableCell:(TUITableViewCell *)cell
@@ -305,9 +829,101 @@ typedef struct {
 		array = [[NSMutableArray alloc] init];
 		[_reusableTableCells setObject:array forKey:identifier];
 	}
+	
+	// the pool is full, let the cell go
+	if([array count] >= [self _maximumReusableCellCountForIdentifier:identifier])
+		return;
+	
 	[array addObject:cell];
 }
 
+/**
+ * @brief Release reusable cells beyond the limit for each identifier
+ * 
+ * The cells enqueued first are released first.
+ */
+- (void)_trimReusableCells
+{
+	for(NSString *identifier in _reusableTableCells) {
+		NSMutableArray *array = [_reusableTableCells objectForKey:identifier];
+		NSUInteger maximum = [self _maximumReusableCellCountForIdentifier:identifier];
+		if([array count] > maximum) {
+			[array removeObjectsInRange:NSMakeRange(0, [array count] - maximum)];
+		}
+	}
+}
+
+- (void)purgeReusableCells
+{
+	[_reusableTableCells removeAllObjects];
+}
+
+- (void)setMaximumReusableCellCount:(NSUInteger)count forIdentifier:(NSString *)identifier
+{
+	if(count > 0) {
+		[_maximumReusableCellCounts setObject:[NSNumber numberWithUnsignedInteger:count] forKey:identifier];
+	} else {
+		[_maximumReusableCellCounts removeObjectForKey:identifier];
+	}
+}
+
+- (void)registerClass:(Class)cellClass forCellReuseIdentifier:(NSString *)identifier
+{
+	if(identifier == nil)
+		return;
+	
+	if(cellClass != Nil) {
+		[_registeredCellClasses setObject:cellClass forKey:identifier];
+	} else {
+		[_registeredCellClasses removeObjectForKey:identifier];
+	}
+}
+
+- (void)prewarmCellsWithIdentifier:(NSString *)identifier count:(NSUInteger)count
+{
+	if(identifier == nil || [_registeredCellClasses objectForKey:identifier] == nil)
+		return;
+	
+	[_prewarmCellCounts setObject:[NSNumber numberWithUnsignedInteger:count] forKey:identifier];
+	
+	// only run when the run loop is idle, i.e. not while tracking a scroll or a drag
+	[NSObject cancelPreviousPerformRequestsWithTarget:self selector:@selector(_prewarmCells) object:nil];
+	[self performSelector:@selector(_prewarmCells) withObject:nil afterDelay:0.0 inModes:[NSArray arrayWithObject:NSDefaultRunLoopMode]];
+}
+
+/**
+ * @brief Create a few cells for each identifier being prewarmed
+ * 
+ * Reschedules itself until every prewarmed identifier has as many reusable
+ * cells as requested, so no single run loop pass does all the work.
+ */
+- (void)_prewarmCells
+{
+	NSUInteger created = 0;
+	
+	for(NSString *identifier in [_prewarmCellCounts allKeys]) {
+		Class cellClass = [_registeredCellClasses objectForKey:identifier];
+		NSUInteger target = [[_prewarmCellCounts objectForKey:identifier] unsignedIntegerValue];
+		
+		NSMutableArray *array = [_reusableTableCells objectForKey:identifier];
+		if(!array) {
+			array = [[NSMutableArray alloc] init];
+			[_reusableTableCells setObject:array forKey:identifier];
+		}
+		
+		while([array count] < target && created < PREWARM_CELLS_PER_PASS) {
+			TUITableViewCell *cell = [[cellClass alloc] initWithStyle:TUITableViewCellStyleDefault reuseIdentifier:identifier];
+			[array insertObject:cell atIndex:0];
+			created++;
+		}
+		
+		if(created >= PREWARM_CELLS_PER_PASS) {
+			[self performSelector:@selector(_prewarmCells) withObject:nil afterDelay:0.0 inModes:[NSArray arrayWithObject:NSDefaultRunLoopMode]];
+			return;
+		}
+	}
+}
+
 - (TUITableViewCell *)dequeueReusableCellWithIdentifier:(NSString *)identifier
 {
 	if(!identifier)
@@ -370,6 +986,25 @@ static NSInteger SortCells(TUITableViewCell *a, TUITableViewCell *b, void *ctx)
 
 #define INDEX_PATHS_FOR_VISIBLE_ROWS [_visibleItems allKeys]
 
+/**
+ * @brief Determine whether an index path lies in an inclusive range of index paths
+ * 
+ * If either bound is nil the range is empty.
+ */
+static BOOL TUIIndexPathInRange(NSIndexPath *indexPath, NSIndexPath *first, NSIndexPath *last)
+{
+	if(first == nil || last == nil)
+		return NO;
+	
+	NSUInteger section = indexPath.section;
+	NSUInteger row = indexPath.row;
+	if(section < first.section || (section == first.section && row < first.row))
+		return NO;
+	if(section > last.section || (section == last.section && row > last.row))
+		return NO;
+	return YES;
+}
+
 - (NSArray *)indexPathsForVisibleRows
 {
 	return INDEX_PATHS_FOR_VISIBLE_ROWS;
@@ -394,13 +1029,17 @@ static NSInteger SortCells(TUITableViewCell *a, TUITableViewCell *b, void *ctx)
 - (NSIndexSet *)indexesOfSectionsInRect:(CGRect)rect
 {
 	NSMutableIndexSet *indexes = [[NSMutableIndexSet alloc] init];
-	
-	for(int i = 0; i < [_sectionInfo count]; i++) {
+
+	CGFloat maxOffset = _contentHeight - CGRectGetMinY(rect);
+	NSInteger numberOfSections = [_sectionInfo count];
+	for(NSInteger i = [self _indexOfFirstSectionEndingAtOrAfterOffset:_contentHeight - CGRectGetMaxY(rect)]; i < numberOfSections; i++) {
+		if([[_sectionInfo objectAtIndex:i] sectionOffset] > maxOffset)
+			break;
 		if(CGRectIntersectsRect([self rectForSection:i], rect)){
 			[indexes addIndex:i];
 		}
 	}
-	
+
 	return indexes;
 }
 
@@ -423,23 +1062,80 @@ static NSInteger SortCells(TUITableViewCell *a, TUITableViewCell *b, void *ctx)
 	return indexes;
 }
 
-- (NSArray *)indexPathsForRowsInRect:(CGRect)rect
+/**
+ * @brief Obtain the first section which ends at or after the specified offset
+ *
+ * Section offsets are cumulative, so this is a binary search over the section
+ * info array.
+ *
+ * @param offset offset from the top of the table content
+ * @return index of the first section ending at or after @p offset, or the
+ * number of sections if there is no such section
+ */
+- (NSInteger)_indexOfFirstSectionEndingAtOrAfterOffset:(CGFloat)offset
 {
-	NSMutableArray *indexPaths = [NSMutableArray arrayWithCapacity:50];
-	NSInteger sectionIndex = 0;
-	for(TUITableViewSection *section in _sectionInfo) {
+	NSInteger low = 0;
+	NSInteger high = [_sectionInfo count];
+	while(low < high) {
+		NSInteger mid = low + (high - low) / 2;
+		TUITableViewSection *section = [_sectionInfo objectAtIndex:mid];
+		if(section.sectionOffset + [section sectionHeight] < offset) {
+			low = mid + 1;
+		} else {
+			high = mid;
+		}
+	}
+	return low;
+}
+
+/**
+ * @brief Enumerate rows which may lie between two offsets
+ *
+ * Offsets are measured from the top of the table content, the same way
+ * section and row offsets are stored. Both bounds are inclusive and rows are
+ * enumerated top to bottom. The first row is located with a binary search, so
+ * the cost is O(log n) plus the number of rows enumerated. Callers are
+ * expected to test each row against their own geometry.
+ *
+ * @param minOffset the offset to begin enumerating at
+ * @param maxOffset the offset to stop enumerating at
+ * @param block the block to enumerate with
+ */
+- (void)_enumerateRowsFromOffset:(CGFloat)minOffset toOffset:(CGFloat)maxOffset usingBlock:(void (^)(NSInteger section, NSInteger row, BOOL *stop))block
+{
+	NSInteger numberOfSections = [_sectionInfo count];
+	for(NSInteger s = [self _indexOfFirstSectionEndingAtOrAfterOffset:minOffset]; s < numberOfSections; ++s) {
+		TUITableViewSection *section = [_sectionInfo objectAtIndex:s];
+		CGFloat sectionOffset = section.sectionOffset;
+		if(sectionOffset > maxOffset)
+			return;
+
 		NSInteger numberOfRows = [section numberOfRows];
-		for(NSInteger row = 0; row < numberOfRows; ++row) {
-			NSIndexPath *indexPath = [NSIndexPath indexPathForRow:row inSection:sectionIndex];
-			CGRect cellRect = [self rectForRowAtIndexPath:indexPath];
-			if(CGRectIntersectsRect(cellRect, rect)) {
-				[indexPaths addObject:indexPath];
-			} else {
-				// not visible
-			}
+		for(NSInteger row = [section indexOfFirstRowEndingAtOrAfterOffset:minOffset - sectionOffset]; row < numberOfRows; ++row) {
+			if(sectionOffset + [section sectionRowOffset:row] > maxOffset)
+				return;
+
+			BOOL stop = NO;
+			block(s, row, &stop);
+			if(stop) return;
 		}
-		++sectionIndex;
 	}
+}
+
+- (NSArray *)indexPathsForRowsInRect:(CGRect)rect
+{
+	NSMutableArray *indexPaths = [NSMutableArray arrayWithCapacity:50];
+	CGFloat minOffset = _contentHeight - CGRectGetMaxY(rect);
+	CGFloat maxOffset = _contentHeight - CGRectGetMinY(rect);
+	[self _enumerateRowsFromOffset:minOffset toOffset:maxOffset usingBlock:^(NSInteger section, NSInteger row, BOOL *stop) {
+		NSIndexPath *indexPath = [NSIndexPath indexPathForRow:row inSection:section];
+		CGRect cellRect = [self rectForRowAtIndexPath:indexPath];
+		if(CGRectIntersectsRect(cellRect, rect)) {
+			[indexPaths addObject:indexPath];
+		} else {
+			// not visible
+		}
+	}];
 	return indexPaths;
 }
 
@@ -453,20 +1149,19 @@ static NSInteger SortCells(TUITableViewCell *a, TUITableViewCell *b, void *ctx)
  * @return index path of the row at @p point
  */
 - (NSIndexPath *)indexPathForRowAtPoint:(CGPoint)point {
-  
-	NSInteger sectionIndex = 0;
-  for(TUITableViewSection *section in _sectionInfo){
-    for(NSInteger row = 0; row < [section numberOfRows]; row++){
-      NSIndexPath *indexPath = [NSIndexPath indexPathForRow:row inSection:sectionIndex];
-      CGRect cellRect = [self rectForRowAtIndexPath:indexPath];
-      if(CGRectContainsPoint(cellRect, point)){
-        return indexPath;
-      }
-    }
-		++sectionIndex;
-  }
-	
-	return nil;
+
+	__block NSIndexPath *result = nil;
+	CGFloat offset = _contentHeight - point.y;
+	[self _enumerateRowsFromOffset:offset toOffset:offset usingBlock:^(NSInteger section, NSInteger row, BOOL *stop) {
+		NSIndexPath *indexPath = [NSIndexPath indexPathForRow:row inSection:section];
+		CGRect cellRect = [self rectForRowAtIndexPath:indexPath];
+		if(CGRectContainsPoint(cellRect, point)){
+			result = indexPath;
+			*stop = YES;
+		}
+	}];
+
+	return result;
 }
 
 /**
@@ -479,20 +1174,19 @@ static NSInteger SortCells(TUITableViewCell *a, TUITableViewCell *b, void *ctx)
  * @return index path of the row at @p offset
  */
 - (NSIndexPath *)indexPathForRowAtVerticalOffset:(CGFloat)offset {
-  
-	NSInteger sectionIndex = 0;
-  for(TUITableViewSection *section in _sectionInfo){
-    for(NSInteger row = 0; row < [section numberOfRows]; row++){
-      NSIndexPath *indexPath = [NSIndexPath indexPathForRow:row inSection:sectionIndex];
-      CGRect cellRect = [self rectForRowAtIndexPath:indexPath];
-      if(offset >= cellRect.origin.y && offset <= (cellRect.origin.y + cellRect.size.height)){
-        return indexPath;
-      }
-    }
-		++sectionIndex;
-  }
-	
-	return nil;
+
+	__block NSIndexPath *result = nil;
+	CGFloat contentOffset = _contentHeight - offset;
+	[self _enumerateRowsFromOffset:contentOffset toOffset:contentOffset usingBlock:^(NSInteger section, NSInteger row, BOOL *stop) {
+		NSIndexPath *indexPath = [NSIndexPath indexPathForRow:row inSection:section];
+		CGRect cellRect = [self rectForRowAtIndexPath:indexPath];
+		if(offset >= cellRect.origin.y && offset <= (cellRect.origin.y + cellRect.size.height)){
+			result = indexPath;
+			*stop = YES;
+		}
+	}];
+
+	return result;
 }
 
 /**
@@ -805,20 +1499,48 @@ static NSInteger SortCells(TUITableViewCell *a, TUITableViewCell *b, void *ctx)
 	
 	CGRect visible = [self visibleRect];
 	
+	// Visible rows always form a contiguous range, so the cells to add and
+	// remove are the difference between the old and the new range.
 	// Example:
 	// old:            0 1 2 3 4 5 6 7
 	// new:                2 3 4 5 6 7 8 9
 	// to remove:      0 1
 	// to add:                         8 9
 	
-	NSArray *oldVisibleIndexPaths = INDEX_PATHS_FOR_VISIBLE_ROWS;
-	NSArray *newVisibleIndexPaths = [self indexPathsForRowsInRect:visible];
+	NSIndexPath *oldFirstVisibleIndexPath = _firstVisibleIndexPath;
+	NSIndexPath *oldLastVisibleIndexPath = _lastVisibleIndexPath;
+	__block NSIndexPath *newFirstVisibleIndexPath = nil;
+	__block NSIndexPath *newLastVisibleIndexPath = nil;
+	[self _enumerateRowsFromOffset:_contentHeight - CGRectGetMaxY(visible) toOffset:_contentHeight - CGRectGetMinY(visible) usingBlock:^(NSInteger section, NSInteger row, BOOL *stop) {
+		NSIndexPath *indexPath = [NSIndexPath indexPathForRow:row inSection:section];
+		if(CGRectIntersectsRect([self rectForRowAtIndexPath:indexPath], visible)) {
+			if(newFirstVisibleIndexPath == nil) newFirstVisibleIndexPath = indexPath;
+			newLastVisibleIndexPath = indexPath;
+		}
+	}];
+	
+	NSMutableArray *indexPathsToRemove = [NSMutableArray array];
+	for(NSIndexPath *i in _visibleItems) {
+		if(!TUIIndexPathInRange(i, newFirstVisibleIndexPath, newLastVisibleIndexPath)) {
+			[indexPathsToRemove addObject:i];
+		}
+	}
 	
-	NSMutableArray *indexPathsToRemove = [oldVisibleIndexPaths mutableCopy];
-	[indexPathsToRemove removeObjectsInArray:newVisibleIndexPaths];
+	NSMutableArray *indexPathsToAdd = [NSMutableArray array];
+	if(newFirstVisibleIndexPath != nil) {
+		[self enumerateIndexPathsFromIndexPath:newFirstVisibleIndexPath toIndexPath:newLastVisibleIndexPath withOptions:0 usingBlock:^(NSIndexPath *indexPath, BOOL *stop) {
+			if(oldFirstVisibleIndexPath == nil) {
+				// no previous range (after a reload or row update), keep any cells already in place
+				if([_visibleItems objectForKey:indexPath] == nil) [indexPathsToAdd addObject:indexPath];
+			} else if(!TUIIndexPathInRange(indexPath, oldFirstVisibleIndexPath, oldLastVisibleIndexPath)) {
+				// the dragged cell stays in place while it's out of range
+				if([_visibleItems objectForKey:indexPath] == nil) [indexPathsToAdd addObject:indexPath];
+			}
+		}];
+	}
 	
-	NSMutableArray *indexPathsToAdd = [newVisibleIndexPaths mutableCopy];
-	[indexPathsToAdd removeObjectsInArray:oldVisibleIndexPaths];
+	_firstVisibleIndexPath = newFirstVisibleIndexPath;
+	_lastVisibleIndexPath = newLastVisibleIndexPath;
 	
 	// remove offscreen cells
 	for(NSIndexPath *i in indexPathsToRemove) {
@@ -869,6 +1591,8 @@ static NSInteger SortCells(TUITableViewCell *a, TUITableViewCell *b, void *ctx)
 		}
 	}
 	
+	[self _updatePrefetchingForVisibleRect:visible];
+	
   // if we have a dragged cell, make sure it's on top of the newly added cells
   if([indexPathsToAdd count] > 0 && _dragToReorderCell != nil){
     [[_dragToReorderCell superview] bringSubviewToFront:_dragToReorderCell];
@@ -909,6 +1633,93 @@ static NSInteger SortCells(TUITableViewCell *a, TUITableViewCell *b, void *ctx)
 	}
 }
 
+/**
+ * @brief Tell the prefetch data source about rows likely to become visible
+ * 
+ * Rows within #prefetchScreenCount screens of the visible area in the
+ * direction of scrolling are prefetched; while throwing, the distance covered
+ * by the throw velocity in the near future is used if it is larger.
+ * Previously prefetched rows which became visible are forgotten and those
+ * which are no longer ahead of the visible area are cancelled.
+ * 
+ * @param visible the visible rect
+ */
+- (void)_updatePrefetchingForVisibleRect:(CGRect)visible
+{
+	if(_prefetchDataSource == nil || _prefetchScreenCount == 0)
+		return;
+	
+	// larger y is towards the top of the content
+	CGFloat movement = CGRectGetMinY(visible) - _lastPrefetchVisibleOrigin;
+	_lastPrefetchVisibleOrigin = CGRectGetMinY(visible);
+	
+	CGFloat distance = visible.size.height * _prefetchScreenCount;
+	if(_throw.throwing && _throw.vy != 0.0) {
+		_prefetchingTowardsTop = (_throw.vy > 0.0);
+		distance = MAX(distance, fabsf(_throw.vy) * PREFETCH_THROW_LOOKAHEAD);
+	} else if(movement != 0.0) {
+		_prefetchingTowardsTop = (movement > 0.0);
+	} else if([_prefetchedIndexPaths count] > 0) {
+		return; // nothing moved since the last update
+	}
+	
+	CGRect prefetchRect;
+	if(_prefetchingTowardsTop) {
+		prefetchRect = CGRectMake(CGRectGetMinX(visible), CGRectGetMaxY(visible), visible.size.width, distance);
+	} else {
+		prefetchRect = CGRectMake(CGRectGetMinX(visible), CGRectGetMinY(visible) - distance, visible.size.width, distance);
+	}
+	
+	NSArray *candidates = [self indexPathsForRowsInRect:prefetchRect];
+	if(_prefetchingTowardsTop) {
+		candidates = [[candidates reverseObjectEnumerator] allObjects];
+	}
+	NSSet *candidateSet = [NSSet setWithArray:candidates];
+	
+	NSMutableArray *indexPathsToCancel = [NSMutableArray array];
+	for(NSIndexPath *indexPath in [_prefetchedIndexPaths allObjects]) {
+		if(TUIIndexPathInRange(indexPath, _firstVisibleIndexPath, _lastVisibleIndexPath)) {
+			[_prefetchedIndexPaths removeObject:indexPath]; // the cell has been requested
+		} else if(![candidateSet containsObject:indexPath]) {
+			[_prefetchedIndexPaths removeObject:indexPath];
+			[indexPathsToCancel addObject:indexPath];
+		}
+	}
+	
+	NSMutableArray *indexPathsToPrefetch = [NSMutableArray array];
+	for(NSIndexPath *indexPath in candidates) {
+		if(![_prefetchedIndexPaths containsObject:indexPath]) {
+			[_prefetchedIndexPaths addObject:indexPath];
+			[indexPathsToPrefetch addObject:indexPath];
+		}
+	}
+	
+	if([indexPathsToCancel count] && [_prefetchDataSource respondsToSelector:@selector(tableView:cancelPrefetchingForRowsAtIndexPaths:)]) {
+		[_prefetchDataSource tableView:self cancelPrefetchingForRowsAtIndexPaths:indexPathsToCancel];
+	}
+	if([indexPathsToPrefetch count]) {
+		[_prefetchDataSource tableView:self prefetchRowsAtIndexPaths:indexPathsToPrefetch];
+	}
+}
+
+/**
+ * @brief Cancel all outstanding prefetches
+ * 
+ * Called when the rows change, since prefetched index paths no longer refer
+ * to the same rows.
+ */
+- (void)_cancelAllPrefetching
+{
+	if([_prefetchedIndexPaths count] == 0)
+		return;
+	
+	NSArray *indexPaths = [_prefetchedIndexPaths allObjects];
+	[_prefetchedIndexPaths removeAllObjects];
+	if([_prefetchDataSource respondsToSelector:@selector(tableView:cancelPrefetchingForRowsAtIndexPaths:)]) {
+		[_prefetchDataSource tableView:self cancelPrefetchingForRowsAtIndexPaths:indexPaths];
+	}
+}
+
 - (BOOL)pullDownViewIsVisible
 {
 	if(_pullDownView) {
@@ -950,6 +1761,9 @@ static NSInteger SortCells(TUITableViewCell *a, TUITableViewCell *b, void *ctx)
 	
 	// clear visible cells
 	[_visibleItems removeAllObjects];
+	_firstVisibleIndexPath = nil;
+	_lastVisibleIndexPath = nil;
+	[self _cancelAllPrefetching];
 	
 	// remove any visible headers, they should be re-added when the table is laid out
 	for(TUITableViewSection *section in _sectionInfo){
@@ -982,14 +1796,19 @@ static NSInteger SortCells(TUITableViewCell *a, TUITableViewCell *b, void *ctx)
 			[CATransaction begin];
 			[CATransaction setDisableActions:YES];
 			
-			BOOL visibleCellsNeedRelayout = [self _preLayoutCells];
+			BOOL visibleCellsNeedRelayout = [self _preLayoutCells] || _tableFlags.visibleCellsNeedRelayout;
+			_tableFlags.visibleCellsNeedRelayout = 0;
 			[super layoutSubviews]; // this will munge with the contentOffset
+			if([self _measureEstimatedRowsNearVisibleRect])
+				visibleCellsNeedRelayout = YES;
 			[self _layoutSectionHeaders:visibleCellsNeedRelayout];
 			[self _layoutCells:visibleCellsNeedRelayout];
 			
 			if(_tableFlags.derepeaterEnabled)
 				[self _updateDerepeaterViews];
 			
+			[self _trimReusableCells];
+			
 			[CATransaction commit];
 		}];
 		
@@ -1005,12 +1824,266 @@ static NSInteger SortCells(TUITableViewCell *a, TUITableViewCell *b, void *ctx)
 	
 	[self _preLayoutCells];
 	[super layoutSubviews]; // this will munge with the contentOffset
+	[self _measureEstimatedRowsNearVisibleRect];
 	[self _layoutSectionHeaders:YES];
 	[self _layoutCells:YES];
 }
 
+- (void)beginUpdates
+{
+	if(_updateNestingLevel++ == 0) {
+		_updateDeletedIndexPaths = [[NSMutableArray alloc] init];
+		_updateInsertedIndexPaths = [[NSMutableArray alloc] init];
+		_updateMovedIndexPaths = [[NSMutableArray alloc] init];
+	}
+}
+
+- (void)endUpdates
+{
+	if(_updateNestingLevel == 0 || --_updateNestingLevel > 0)
+		return;
+	
+	NSArray *deleted = _updateDeletedIndexPaths;
+	NSArray *inserted = _updateInsertedIndexPaths;
+	NSArray *moved = _updateMovedIndexPaths;
+	_updateDeletedIndexPaths = nil;
+	_updateInsertedIndexPaths = nil;
+	_updateMovedIndexPaths = nil;
+	
+	if([deleted count] || [inserted count] || [moved count]) {
+		[self _applyRowUpdatesDeleting:deleted inserting:inserted moving:moved];
+	}
+}
+
+- (void)insertRowsAtIndexPaths:(NSArray *)indexPaths
+{
+	[self beginUpdates];
+	[_updateInsertedIndexPaths addObjectsFromArray:indexPaths];
+	[self endUpdates];
+}
+
+- (void)deleteRowsAtIndexPaths:(NSArray *)indexPaths
+{
+	[self beginUpdates];
+	[_updateDeletedIndexPaths addObjectsFromArray:indexPaths];
+	[self endUpdates];
+}
+
+- (void)moveRowAtIndexPath:(NSIndexPath *)indexPath toIndexPath:(NSIndexPath *)newIndexPath
+{
+	[self beginUpdates];
+	[_updateMovedIndexPaths addObject:[NSArray arrayWithObjects:indexPath, newIndexPath, nil]];
+	[self endUpdates];
+}
+
+/**
+ * @brief Apply a batch of row updates
+ * 
+ * Only sections which have rows deleted, inserted or moved are rebuilt; the
+ * heights of surviving rows are kept and only new rows are measured. Visible
+ * cells for surviving rows are kept and rekeyed by their new index paths. The
+ * topmost visible row which survives the update stays at the same position in
+ * the visible area (or the content offset is kept as is, if
+ * #maintainContentOffsetAfterReload is set).
+ * 
+ * If the updates are inconsistent with the data source the table is reloaded
+ * instead.
+ * 
+ * @param deleted index paths of deleted rows, before the update
+ * @param inserted index paths of inserted rows, after the update
+ * @param moved pairs of index paths, before and after the update
+ */
+- (void)_applyRowUpdatesDeleting:(NSArray *)deleted inserting:(NSArray *)inserted moving:(NSArray *)moved
+{
+	// nothing has been laid out yet, the next layout will pick up the changes
+	if(_sectionInfo == nil)
+		return;
+	
+	NSInteger numberOfSections = [_sectionInfo count];
+	NSInteger newNumberOfSections = (_tableFlags.dataSourceNumberOfSectionsInTableView) ? [_dataSource numberOfSectionsInTableView:self] : 1;
+	if(newNumberOfSections != numberOfSections) {
+		NSLog(@"Warning: number of sections changed in a row update, reloading table %@", self);
+		[self reloadData];
+		return;
+	}
+	
+	NSMutableIndexSet *affectedSections = [NSMutableIndexSet indexSet];
+	NSMutableDictionary *movedIndexPaths = [NSMutableDictionary dictionaryWithCapacity:[moved count]];
+	for(NSIndexPath *indexPath in deleted) [affectedSections addIndex:indexPath.section];
+	for(NSIndexPath *indexPath in inserted) [affectedSections addIndex:indexPath.section];
+	for(NSArray *pair in moved) {
+		NSIndexPath *fromIndexPath = [pair objectAtIndex:0];
+		NSIndexPath *toIndexPath = [pair objectAtIndex:1];
+		[affectedSections addIndex:fromIndexPath.section];
+		[affectedSections addIndex:toIndexPath.section];
+		[movedIndexPaths setObject:toIndexPath forKey:fromIndexPath];
+	}
+	
+	TUITableViewRowInfo **newRowInfo = calloc(numberOfSections, sizeof(TUITableViewRowInfo *));
+	NSInteger **oldToNewRows = calloc(numberOfSections, sizeof(NSInteger *));
+	NSUInteger *newNumberOfRows = calloc(numberOfSections, sizeof(NSUInteger));
+	BOOL consistent = ([affectedSections count] == 0 || [affectedSections lastIndex] < numberOfSections);
+	
+	for(NSUInteger s = [affectedSections firstIndex]; consistent && s != NSNotFound; s = [affectedSections indexGreaterThanIndex:s]) {
+		TUITableViewSection *section = [_sectionInfo objectAtIndex:s];
+		NSUInteger oldCount = [section numberOfRows];
+		NSUInteger newCount = [_dataSource tableView:self numberOfRowsInSection:s];
+		
+		TUITableViewRowInfo *info = calloc(MAX(newCount, 1), sizeof(TUITableViewRowInfo));
+		NSInteger *oldToNew = calloc(MAX(oldCount, 1), sizeof(NSInteger));
+		BOOL *filled = calloc(MAX(newCount, 1), sizeof(BOOL));
+		newRowInfo[s] = info;
+		oldToNewRows[s] = oldToNew;
+		newNumberOfRows[s] = newCount;
+		
+		// rows leaving this section
+		for(NSIndexPath *indexPath in deleted) {
+			if(indexPath.section != s) continue;
+			if(indexPath.row >= oldCount) { consistent = NO; break; }
+			oldToNew[indexPath.row] = -1;
+		}
+		for(NSArray *pair in moved) {
+			NSIndexPath *fromIndexPath = [pair objectAtIndex:0];
+			if(fromIndexPath.section != s) continue;
+			if(fromIndexPath.row >= oldCount) { consistent = NO; break; }
+			oldToNew[fromIndexPath.row] = -1;
+		}
+		
+		// rows arriving in this section
+		for(NSIndexPath *indexPath in inserted) {
+			if(indexPath.section != s) continue;
+			if(indexPath.row >= newCount || filled[indexPath.row]) { consistent = NO; break; }
+			info[indexPath.row] = [section _rowInfoForNewRow:indexPath.row usingEstimates:_tableFlags.usesEstimatedRowHeights];
+			filled[indexPath.row] = YES;
+		}
+		for(NSArray *pair in moved) {
+			NSIndexPath *fromIndexPath = [pair objectAtIndex:0];
+			NSIndexPath *toIndexPath = [pair objectAtIndex:1];
+			if(toIndexPath.section != s) continue;
+			if(toIndexPath.row >= newCount || filled[toIndexPath.row] || fromIndexPath.section >= numberOfSections ||
+			   fromIndexPath.row >= [[_sectionInfo objectAtIndex:fromIndexPath.section] numberOfRows]) { consistent = NO; break; }
+			info[toIndexPath.row] = [[_sectionInfo objectAtIndex:fromIndexPath.section] rowInfoAtIndex:fromIndexPath.row];
+			filled[toIndexPath.row] = YES;
+		}
+		
+		// surviving rows fill the remaining slots in their original order
+		NSUInteger newRow = 0;
+		for(NSUInteger row = 0; consistent && row < oldCount; ++row) {
+			if(oldToNew[row] < 0) continue;
+			while(newRow < newCount && filled[newRow]) ++newRow;
+			if(newRow >= newCount) { consistent = NO; break; }
+			info[newRow] = [section rowInfoAtIndex:row];
+			filled[newRow] = YES;
+			oldToNew[row] = newRow++;
+		}
+		while(consistent && newRow < newCount) {
+			if(!filled[newRow++]) consistent = NO;
+		}
+		
+		free(filled);
+	}
+	
+	NSIndexPath *(^newIndexPathForIndexPath)(NSIndexPath *) = ^NSIndexPath *(NSIndexPath *indexPath) {
+		if(indexPath == nil || indexPath.section >= numberOfSections) return nil;
+		NSIndexPath *movedIndexPath = [movedIndexPaths objectForKey:indexPath];
+		if(movedIndexPath != nil) return movedIndexPath;
+		NSInteger *oldToNew = oldToNewRows[indexPath.section];
+		if(oldToNew == NULL) return indexPath;
+		if(indexPath.row >= [[_sectionInfo objectAtIndex:indexPath.section] numberOfRows]) return nil;
+		NSInteger row = oldToNew[indexPath.row];
+		return (row < 0) ? nil : [NSIndexPath indexPathForRow:row inSection:indexPath.section];
+	};
+	
+	if(consistent) {
+		// find the topmost visible row which survives, to keep it in place
+		CGFloat previousTop = self.contentSize.height + self.contentOffset.y;
+		NSIndexPath *anchorIndexPath = nil;
+		CGFloat anchorOffset = 0.0;
+		if(!_tableFlags.maintainContentOffsetAfterReload) {
+			for(NSIndexPath *indexPath in [INDEX_PATHS_FOR_VISIBLE_ROWS sortedArrayUsingSelector:@selector(compare:)]) {
+				if((anchorIndexPath = newIndexPathForIndexPath(indexPath)) != nil) {
+					anchorOffset = [[_sectionInfo objectAtIndex:indexPath.section] tableRowOffset:indexPath.row];
+					break;
+				}
+			}
+		}
+		
+		// rekey surviving cells and recycle the others; this must happen before
+		// the section info is replaced since the mapping refers to the old rows
+		NSMutableDictionary *visibleItems = [[NSMutableDictionary alloc] initWithCapacity:[_visibleItems count]];
+		for(NSIndexPath *indexPath in _visibleItems) {
+			TUITableViewCell *cell = [_visibleItems objectForKey:indexPath];
+			NSIndexPath *newIndexPath = newIndexPathForIndexPath(indexPath);
+			if(newIndexPath != nil) {
+				[visibleItems setObject:cell forKey:newIndexPath];
+			} else if(cell != _dragToReorderCell) {
+				[self _enqueueReusableCell:cell];
+				[cell removeFromSuperview];
+			}
+		}
+		[_visibleItems removeAllObjects];
+		[_visibleItems addEntriesFromDictionary:visibleItems];
+		
+		// the surviving cells no longer form a contiguous range
+		_firstVisibleIndexPath = nil;
+		_lastVisibleIndexPath = nil;
+		[self _cancelAllPrefetching];
+		
+		_selectedIndexPath = newIndexPathForIndexPath(_selectedIndexPath);
+		_indexPathShouldBeFirstResponder = newIndexPathForIndexPath(_indexPathShouldBeFirstResponder);
+		
+		for(NSUInteger s = [affectedSections firstIndex]; s != NSNotFound; s = [affectedSections indexGreaterThanIndex:s]) {
+			[[_sectionInfo objectAtIndex:s] _replaceRowInfo:newRowInfo[s] numberOfRows:newNumberOfRows[s]];
+			newRowInfo[s] = NULL; // now owned by the section
+		}
+		
+		CGFloat offset = [[_sectionInfo objectAtIndex:[affectedSections firstIndex]] sectionOffset];
+		for(NSInteger s = [affectedSections firstIndex]; s < numberOfSections; ++s) {
+			TUITableViewSection *section = [_sectionInfo objectAtIndex:s];
+			section.sectionOffset = offset;
+			offset += [section sectionHeight];
+		}
+		
+		_contentHeight = offset - self.contentInset.bottom;
+		self.contentSize = CGSizeMake(self.bounds.size.width, _contentHeight);
+		
+		// restore scroll position
+		if(anchorIndexPath != nil) {
+			CGFloat newAnchorOffset = [[_sectionInfo objectAtIndex:anchorIndexPath.section] tableRowOffset:anchorIndexPath.row];
+			self.contentOffset = CGPointMake(self.contentOffset.x, previousTop + (newAnchorOffset - anchorOffset) - self.contentSize.height);
+		} else {
+			self.contentOffset = CGPointMake(self.contentOffset.x, previousTop - self.contentSize.height);
+		}
+	}
+	
+	for(NSInteger s = 0; s < numberOfSections; ++s) {
+		if(newRowInfo[s]) free(newRowInfo[s]);
+		if(oldToNewRows[s]) free(oldToNewRows[s]);
+	}
+	free(newRowInfo);
+	free(oldToNewRows);
+	free(newNumberOfRows);
+	
+	if(!consistent) {
+		NSLog(@"Warning: row update is inconsistent with the data source, reloading table %@", self);
+		[self reloadData];
+		return;
+	}
+	
+	[self _precomputeRowHeights]; // batches in flight refer to the old rows
+	
+	_tableFlags.visibleCellsNeedRelayout = 1;
+	[self layoutSubviews];
+}
+
 - (void)scrollToRowAtIndexPath:(NSIndexPath *)indexPath atScrollPosition:(TUITableViewScrollPosition)scrollPosition animated:(BOOL)animated
 {
+	// make sure we scroll to the real position of the row, not an estimate
+	if(indexPath.section < [_sectionInfo count]) {
+		CGFloat rowOffset = [[_sectionInfo objectAtIndex:indexPath.section] tableRowOffset:indexPath.row];
+		[self _measureEstimatedRowsFromOffset:rowOffset toOffset:rowOffset];
+	}
+	
 	CGRect v = [self visibleRect];
 	CGRect r = [self rectForRowAtIndexPath:indexPath];
 	
@@ -42,6 +42,7 @@
 
 - (void)prepareForReuse
 {
+	[self cancelBackgroundDrawing]; // a render in flight is for the previous row
 	[self removeAllAnimations];
 	[self.textRenderers makeObjectsPerformSelector:@selector(resetSelection)];
 	[self setNeedsDisplay];
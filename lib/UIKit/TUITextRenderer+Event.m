@@ -60,7 +60,14 @@
 
 - (CFIndex)stringIndexForPoint:(CGPoint)p
 {
-	return AB_CTFrameGetStringIndexForPosition([self ctFrame], p);
+	AB_CTFrameMetricsRef metrics = [self ctFrameMetrics];
+	if(!metrics)
+		return 0;
+	
+	// p is relative to frame, the lines to where the frame is drawn for the vertical alignment
+	p.x += frame.origin.x - _layoutOrigin.x;
+	p.y += frame.origin.y - _layoutOrigin.y;
+	return AB_CTFrameMetricsGetStringIndexForPosition(metrics, p);
 }
 
 - (CFIndex)stringIndexForEvent:(NSEvent *)event
@@ -243,15 +250,10 @@ normal:
 }
 
 - (CGRect)rectForRange:(CFRange)range {
-	CTFrameRef textFrame = [self ctFrame];
-	CGRect totalRect = CGRectNull;
-	if(range.length > 0) {
-		CFIndex rectCount = 100;
-		CGRect rects[rectCount];
-		AB_CTFrameGetRectsForRangeWithAggregationType(textFrame, range, AB_CTLineRectAggregationTypeBlock, rects, &rectCount);
-		
-		for(CFIndex i = 0; i < rectCount; ++i) {
-			CGRect rect = rects[i];
+	AB_CTFrameMetricsRef metrics = [self ctFrameMetrics];
+	__block CGRect totalRect = CGRectNull;
+	if(range.length > 0 && metrics) {
+		AB_CTFrameMetricsEnumerateRectsForRange(metrics, range, AB_CTLineRectAggregationTypeBlock, ^(CGRect rect, BOOL *stop) {
 			rect = CGRectIntegral(rect);
 			
 			if(CGRectEqualToRect(totalRect, CGRectNull)) {
@@ -259,7 +261,7 @@ normal:
 			} else {
 				totalRect = CGRectUnion(rect, totalRect);
 			}
-		}
+		});
 	}
 	
 	return totalRect;
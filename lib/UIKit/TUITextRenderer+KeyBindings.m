@@ -86,7 +86,7 @@ static NSAttributedString *killBuffer = nil;
 		CFRange r = CFRangeMake(index, 0);
 		CFIndex nRects = 1;
 		CGRect rects[nRects];
-		AB_CTFrameGetRectsForRange([self ctFrame], r, rects, &nRects);
+		AB_CTFrameMetricsGetRectsForRange([self ctFrameMetrics], r, AB_CTLineRectAggregationTypeInline, rects, &nRects);
 		
 		if (nRects == 1) {
 			// If it exists, then scroll to the beginning of the rects.
@@ -104,7 +104,7 @@ static NSAttributedString *killBuffer = nil;
 							by:(CFIndex)incr {
 	CFIndex lineIndex;
 	float xPosition;
-	AB_CTFrameGetLinePositionOfIndex(TEXT, [self ctFrame], index, &lineIndex, &xPosition);
+	AB_CTFrameMetricsGetLinePositionOfIndex([self ctFrameMetrics], index, &lineIndex, &xPosition);
 	
 	if(lineIndex >= 0) {
 		NSArray *lines = (__bridge NSArray *)CTFrameGetLines([self ctFrame]);
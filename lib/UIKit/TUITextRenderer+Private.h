@@ -3,11 +3,14 @@
 @interface TUITextRenderer ()
 
 - (CTFramesetterRef)ctFramesetter;
-- (CTFrameRef)ctFrame;
+- (CTFrameRef)ctFrame; // laid out at the origin, drawn translated into frame
+- (AB_CTFrameMetricsRef)ctFrameMetrics; // rects in the coordinates of frame
 - (CGPathRef)ctPath;
 - (CFRange)_selectedRange;
 - (void)_resetFramesetter;
 
++ (CGSize)sizeOfAttributedString:(NSAttributedString *)string constrainedToSize:(CGSize)size; // through the layout cache
+
 @end
 
 @interface TUITextRenderer (KeyBindings)
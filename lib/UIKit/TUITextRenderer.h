@@ -33,8 +33,7 @@ typedef enum {
 
 typedef enum {
 	TUITextVerticalAlignmentTop = 0,
-	// Note that TUITextVerticalAlignmentMiddle and TUITextVerticalAlignmentBottom both have a performance hit because they have to create the CTFrame twice: once to find its height and then again to shift it to match the alignment and height.
-	// Also note that text selection doesn't work properly with anything but TUITextVerticalAlignmentTop.
+	// TUITextVerticalAlignmentMiddle and TUITextVerticalAlignmentBottom lay the text out once, like TUITextVerticalAlignmentTop, and draw it shifted down. Selection and hit testing follow the shift.
 	TUITextVerticalAlignmentMiddle,
 	TUITextVerticalAlignmentBottom,
 } TUITextVerticalAlignment;
@@ -47,8 +46,15 @@ typedef enum {
 	TUIView *__unsafe_unretained view; // unsafe_unretained
 	
 	CTFramesetterRef _ct_framesetter;
-	CGPathRef _ct_path;
 	CTFrameRef _ct_frame;
+	CGPoint _layoutOrigin; // where _ct_frame is drawn
+	AB_CTFrameMetricsRef _ct_metrics;
+	id _layoutCacheEntry; // shared layout of attributedString, see +layoutCacheHitCount
+	NSArray *_decorations; // pre-draw blocks and background fills with their rects, built once per frame
+	
+	CFRange _selectionRectsRange;
+	CGRect *_selectionRects;
+	CFIndex _selectionRectCount;
 	
 	CFIndex _selectionStart;
 	CFIndex _selectionEnd;
@@ -89,7 +95,8 @@ typedef enum {
 
 @property (nonatomic, assign) TUITextVerticalAlignment verticalAlignment;
 
-// These are advanced features that carry with them a potential performance hit.
+// Decorations are collected in one pass over the string the first time a
+// frame is drawn, and replayed from then on until the text or frame changes.
 @property (nonatomic, assign) BOOL backgroundDrawingEnabled; // default = NO
 @property (nonatomic, assign) BOOL preDrawBlocksEnabled; // default = NO
 
@@ -105,6 +112,15 @@ typedef enum {
 - (CGSize)sizeConstrainedToWidth:(CGFloat)width numberOfLines:(NSUInteger)numberOfLines;
 - (void)reset;
 
+// Layouts are shared between all renderers and string drawing through one
+// cache keyed by the drawn string and the size it's laid out at, so laying out
+// the same text at the same size again is free, whatever the frame's origin or
+// the thread. Strings over a few thousand characters are left out.
++ (NSUInteger)layoutCacheHitCount;
++ (NSUInteger)layoutCacheMissCount;
++ (void)setLayoutCacheMemoryLimit:(NSUInteger)bytes; // default is 8MB
++ (void)purgeLayoutCache;
+
 // The -drawingAttributedString method allows for direct access
 // to the string being drawn to the screen. For example, if the
 // text rendering control is secure, this string would then 
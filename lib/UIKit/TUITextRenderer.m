@@ -15,6 +15,8 @@
  */
 
 #import "TUITextRenderer.h"
+#import "TUITextRenderer+Private.h"
+#import <libkern/OSAtomic.h>
 #import "ABActiveRange.h"
 #import "NSColor+TUIExtensions.h"
 #import "TUIAttributedString.h"
@@ -29,6 +31,162 @@ NSString *const TUITextRendererDidResignFirstResponder = @"TUITextRendererDidRes
 @property (nonatomic, strong) NSMutableDictionary *lineRects;
 @end
 
+#define LAYOUT_CACHE_DEFAULT_MEMORY_LIMIT (8 * 1024 * 1024)
+#define LAYOUT_CACHE_MAXIMUM_STRING_LENGTH 4096 // longer strings are usually being edited
+#define LAYOUT_CACHE_FRAMES_PER_STRING 4
+#define LAYOUT_CACHE_BYTES_PER_CHARACTER 64 // rough cost of a framesetter or frame
+
+/*
+ * The layout of one attributed string: its framesetter, and the frames built
+ * from it for the last few sizes it was laid out in. Frames are laid out in a
+ * path at the origin, so they can be drawn anywhere by translating them.
+ * Framesetters can't be used from two threads at once, so frames are only
+ * built with the entry locked; the frames themselves are immutable and are
+ * shared by any number of threads.
+ */
+@interface TUITextLayoutCacheEntry : NSObject
+{
+	@public
+	CTFramesetterRef framesetter;
+	NSMutableDictionary *frames; // NSValue of the size -> CTFrame
+	NSMutableArray *frameKeys; // least recently used first
+}
+@end
+
+@implementation TUITextLayoutCacheEntry
+
+- (void)dealloc
+{
+	if(framesetter)
+		CFRelease(framesetter);
+}
+
+@end
+
+/*
+ * Layouts shared between all text renderers and string drawing, whatever
+ * thread they're on. A string measured on a background queue and then drawn on
+ * the main thread is typeset once, and laying it out at the same size again
+ * (redrawing, or reusing a cell) is free. Entries are keyed by a copy of the
+ * string and evicted by NSCache once their estimated cost goes over the memory
+ * limit.
+ */
+static volatile int64_t TUITextLayoutCacheHits = 0;
+static volatile int64_t TUITextLayoutCacheMisses = 0;
+
+static NSCache *TUITextLayoutCache(void)
+{
+	static NSCache *cache = nil;
+	static dispatch_once_t onceToken;
+	dispatch_once(&onceToken, ^{
+		cache = [[NSCache alloc] init];
+		cache.totalCostLimit = LAYOUT_CACHE_DEFAULT_MEMORY_LIMIT;
+	});
+	return cache;
+}
+
+static TUITextLayoutCacheEntry *TUITextLayoutCacheEntryForString(NSAttributedString *string)
+{
+	if(!string || [string length] > LAYOUT_CACHE_MAXIMUM_STRING_LENGTH)
+		return nil;
+	
+	NSCache *cache = TUITextLayoutCache();
+	TUITextLayoutCacheEntry *entry = [cache objectForKey:string];
+	if(entry)
+		return entry;
+	
+	CTFramesetterRef framesetter = CTFramesetterCreateWithAttributedString((__bridge CFAttributedStringRef)string);
+	if(!framesetter)
+		return nil;
+	
+	entry = [[TUITextLayoutCacheEntry alloc] init];
+	entry->framesetter = framesetter;
+	entry->frames = [[NSMutableDictionary alloc] init];
+	entry->frameKeys = [[NSMutableArray alloc] init];
+	
+	// a framesetter plus a few frames
+	NSUInteger cost = [string length] * LAYOUT_CACHE_BYTES_PER_CHARACTER * (1 + LAYOUT_CACHE_FRAMES_PER_STRING);
+	[cache setObject:entry forKey:[string copy] cost:cost]; // the key mustn't change under the cache
+	return entry;
+}
+
+static CTFrameRef TUITextLayoutCacheEntryCopyFrame(TUITextLayoutCacheEntry *entry, CGSize size)
+{
+	NSValue *key = [NSValue valueWithSize:size];
+	
+	@synchronized(entry) {
+		CTFrameRef f = (__bridge CTFrameRef)[entry->frames objectForKey:key];
+		if(f) {
+			[entry->frameKeys removeObject:key];
+			[entry->frameKeys addObject:key];
+			OSAtomicIncrement64(&TUITextLayoutCacheHits);
+			return (CTFrameRef)CFRetain(f);
+		}
+		OSAtomicIncrement64(&TUITextLayoutCacheMisses);
+		
+		CGPathRef path = CGPathCreateWithRect(CGRectMake(0, 0, size.width, size.height), NULL);
+		f = CTFramesetterCreateFrame(entry->framesetter, CFRangeMake(0, 0), path, NULL);
+		CGPathRelease(path);
+		
+		if(f) {
+			if([entry->frameKeys count] >= LAYOUT_CACHE_FRAMES_PER_STRING) {
+				[entry->frames removeObjectForKey:[entry->frameKeys objectAtIndex:0]];
+				[entry->frameKeys removeObjectAtIndex:0];
+			}
+			[entry->frames setObject:(__bridge id)f forKey:key];
+			[entry->frameKeys addObject:key];
+		}
+		return f;
+	}
+}
+
+/*
+ * A run of text drawn with the same pre-draw block or background color, and
+ * the rects it covers in the current frame.
+ */
+@interface TUITextDecoration : NSObject
+{
+	@public
+	BOOL isBackground; // otherwise a pre-draw block
+	id value;
+	NSRange range;
+	AB_CTLineRectAggregationType aggregationType;
+	CGRect *rects;
+	CFIndex rectCount;
+}
+@end
+
+@implementation TUITextDecoration
+
+- (void)dealloc
+{
+	free(rects);
+}
+
+@end
+
+/*
+ * Extends the decoration being collected with the next attribute run, or starts
+ * a new one if the value changed. Returns the decoration now being collected.
+ */
+static TUITextDecoration *TUITextDecorationAppendRun(TUITextDecoration *current, NSMutableArray *decorations, BOOL isBackground, id value, NSRange range, NSNumber *fillStyle)
+{
+	if(current && NSMaxRange(current->range) == range.location && [current->value isEqual:value]) {
+		current->range.length += range.length;
+		return current;
+	}
+	if(!value)
+		return nil;
+	
+	TUITextDecoration *decoration = [[TUITextDecoration alloc] init];
+	decoration->isBackground = isBackground;
+	decoration->value = value;
+	decoration->range = range;
+	decoration->aggregationType = (AB_CTLineRectAggregationType)[fillStyle integerValue];
+	[decorations addObject:decoration];
+	return decoration;
+}
+
 @implementation TUITextRenderer
 
 @synthesize attributedString;
@@ -47,11 +205,17 @@ NSString *const TUITextRendererDidResignFirstResponder = @"TUITextRendererDidRes
 		CFRelease(_ct_frame);
 		_ct_frame = NULL;
 	}
-	if(_ct_path) {
-		CGPathRelease(_ct_path);
-		_ct_path = NULL;
+	if(_ct_metrics) {
+		AB_CTFrameMetricsRelease(_ct_metrics);
+		_ct_metrics = NULL;
+	}
+	if(_selectionRects) {
+		free(_selectionRects);
+		_selectionRects = NULL;
+		_selectionRectCount = 0;
 	}
 	
+	_decorations = nil;
 	lineRects = nil;
 }
 
@@ -61,6 +225,7 @@ NSString *const TUITextRendererDidResignFirstResponder = @"TUITextRendererDidRes
 		CFRelease(_ct_framesetter);
 		_ct_framesetter = NULL;
 	}
+	_layoutCacheEntry = nil;
 	
 	[self _resetFrame];
 }
@@ -78,50 +243,96 @@ NSString *const TUITextRendererDidResignFirstResponder = @"TUITextRendererDidRes
 	[self _resetFramesetter];
 }
 
-- (void)_buildFrameWithEffectiveFrame:(CGRect)effectiveFrame
+- (void)_buildFrame
 {
-	[self _resetFrame];
+	if(_ct_frame)
+		return;
+	
+	// frames are laid out at the origin, so the cached layout for this size fits any frame origin
+	TUITextLayoutCacheEntry *entry = _layoutCacheEntry;
+	if(entry) {
+		_ct_frame = TUITextLayoutCacheEntryCopyFrame(entry, frame.size);
+	} else if(_ct_framesetter) {
+		CGPathRef path = CGPathCreateWithRect(CGRectMake(0, 0, frame.size.width, frame.size.height), NULL);
+		_ct_frame = CTFramesetterCreateFrame(_ct_framesetter, CFRangeMake(0, 0), path, NULL);
+		CGPathRelease(path);
+	}
+	if(!_ct_frame)
+		return;
 	
-	_ct_path = CGPathCreateMutable();
-	CGPathAddRect((CGMutablePathRef)_ct_path, NULL, effectiveFrame);
-	_ct_frame = CTFramesetterCreateFrame(_ct_framesetter, CFRangeMake(0, 0), _ct_path, NULL);
+	// TUITextVerticalAlignmentTop is easy since that's how Core Text always draws. For Middle and Bottom the
+	// same frame is drawn shifted down by the space left under the text, and the metrics and hit testing follow it.
+	_layoutOrigin = frame.origin;
+	if(verticalAlignment != TUITextVerticalAlignmentTop) {
+		CGFloat space = frame.size.height - AB_CTFrameGetSize(_ct_frame).height;
+		if(verticalAlignment == TUITextVerticalAlignmentMiddle)
+			space /= 2;
+		_layoutOrigin.y -= round(space);
+	}
 }
 
-- (void)_buildFrame
+- (void)_buildFramesetter
 {
-	if(!_ct_path) {
-		[self _buildFrameWithEffectiveFrame:frame];
-		
-		// TUITextVerticalAlignmentTop is easy since that's how Core Text always draws. For Middle and Bottom we have to shift the CTFrame down.
-		if(verticalAlignment != TUITextVerticalAlignmentTop) {
-			CGRect effectiveFrame = frame;
-			
-			CGSize size = AB_CTFrameGetSize(_ct_frame);
-			if(verticalAlignment == TUITextVerticalAlignmentMiddle) {
-				effectiveFrame.origin.y = size.height/2 - frame.size.height/2;
-			} else if(verticalAlignment == TUITextVerticalAlignmentBottom) {
-				effectiveFrame.origin.y = size.height;
-			}
-			
-			effectiveFrame = CGRectIntegral(effectiveFrame);
-			
-			[self _buildFrameWithEffectiveFrame:effectiveFrame];
-		}
+	if(!_ct_framesetter && !_layoutCacheEntry) {
+		NSAttributedString *string = self.drawingAttributedString;
+		_layoutCacheEntry = TUITextLayoutCacheEntryForString(string);
+		if(!_layoutCacheEntry)
+			_ct_framesetter = CTFramesetterCreateWithAttributedString((__bridge CFAttributedStringRef)string);
 	}
+	
+	[self _buildFrame];
 }
 
-- (void)_buildFramesetter
++ (NSUInteger)layoutCacheHitCount
 {
-	if(!_ct_framesetter) {
-		_ct_framesetter = CTFramesetterCreateWithAttributedString((__bridge CFAttributedStringRef)self.drawingAttributedString);
+	return (NSUInteger)TUITextLayoutCacheHits;
+}
+
++ (NSUInteger)layoutCacheMissCount
+{
+	return (NSUInteger)TUITextLayoutCacheMisses;
+}
+
++ (void)setLayoutCacheMemoryLimit:(NSUInteger)bytes
+{
+	TUITextLayoutCache().totalCostLimit = bytes;
+}
+
++ (void)purgeLayoutCache
+{
+	// renderers holding on to a layout keep it until their text changes
+	[TUITextLayoutCache() removeAllObjects];
+}
+
++ (CGSize)sizeOfAttributedString:(NSAttributedString *)string constrainedToSize:(CGSize)size
+{
+	CTFrameRef f = NULL;
+	TUITextLayoutCacheEntry *entry = TUITextLayoutCacheEntryForString(string);
+	if(entry) {
+		f = TUITextLayoutCacheEntryCopyFrame(entry, size);
+	} else {
+		CTFramesetterRef framesetter = CTFramesetterCreateWithAttributedString((__bridge CFAttributedStringRef)string);
+		CGPathRef path = CGPathCreateWithRect(CGRectMake(0, 0, size.width, size.height), NULL);
+		f = CTFramesetterCreateFrame(framesetter, CFRangeMake(0, 0), path, NULL);
+		CGPathRelease(path);
+		CFRelease(framesetter);
 	}
 	
-	[self _buildFrame];
+	CGSize s = CGSizeZero;
+	if(f) {
+		s = AB_CTFrameGetSize(f);
+		CFRelease(f);
+	}
+	return s;
 }
 
 - (CTFramesetterRef)ctFramesetter
 {
 	[self _buildFramesetter];
+	if(!_ct_framesetter) {
+		// the cached framesetter is only used with its entry locked, so hand out one of our own
+		_ct_framesetter = CTFramesetterCreateWithAttributedString((__bridge CFAttributedStringRef)self.drawingAttributedString);
+	}
 	return _ct_framesetter;
 }
 
@@ -131,10 +342,54 @@ NSString *const TUITextRendererDidResignFirstResponder = @"TUITextRendererDidRes
 	return _ct_frame;
 }
 
+- (AB_CTFrameMetricsRef)ctFrameMetrics
+{
+	CTFrameRef f = [self ctFrame];
+	if(!_ct_metrics && f)
+		_ct_metrics = AB_CTFrameMetricsCreateWithOrigin(f, _layoutOrigin);
+	return _ct_metrics;
+}
+
+- (NSArray *)_decorations
+{
+	if(!_decorations) {
+		NSAttributedString *string = self.drawingAttributedString;
+		NSMutableArray *decorations = [NSMutableArray array];
+		
+		// one pass over the attribute runs, merging adjacent runs with the same block or color
+		__block TUITextDecoration *preDraw = nil;
+		__block TUITextDecoration *background = nil;
+		[string enumerateAttributesInRange:NSMakeRange(0, [string length]) options:0 usingBlock:^(NSDictionary *attributes, NSRange range, BOOL *stop) {
+			NSNumber *fillStyle = [attributes objectForKey:TUIAttributedStringBackgroundFillStyleName];
+			preDraw = TUITextDecorationAppendRun(preDraw, decorations, NO, [attributes objectForKey:TUIAttributedStringPreDrawBlockName], range, fillStyle);
+			background = TUITextDecorationAppendRun(background, decorations, YES, [attributes objectForKey:TUIAttributedStringBackgroundColorAttributeName], range, fillStyle);
+		}];
+		
+		AB_CTFrameMetricsRef metrics = [self ctFrameMetrics];
+		for(TUITextDecoration *decoration in decorations) {
+			decoration->rects = AB_CTFrameMetricsCopyRectsForRange(metrics, CFRangeMake(decoration->range.location, decoration->range.length), decoration->aggregationType, &decoration->rectCount);
+		}
+		
+		_decorations = decorations;
+	}
+	return _decorations;
+}
+
+- (CGRect *)_selectionRectsForRange:(CFRange)range count:(CFIndex *)count
+{
+	if(!_selectionRects || _selectionRectsRange.location != range.location || _selectionRectsRange.length != range.length) {
+		free(_selectionRects);
+		_selectionRects = AB_CTFrameMetricsCopyRectsForRange([self ctFrameMetrics], range, AB_CTLineRectAggregationTypeInline, &_selectionRectCount);
+		_selectionRectsRange = range;
+	}
+	*count = _selectionRectCount;
+	return _selectionRects;
+}
+
 - (CGPathRef)ctPath
 {
-	[self _buildFramesetter];
-	return _ct_path;
+	CTFrameRef f = [self ctFrame];
+	return f ? CTFrameGetPath(f) : NULL;
 }
 
 - (CFIndex)_clampToValidRange:(CFIndex)index
@@ -232,56 +487,50 @@ NSString *const TUITextRendererDidResignFirstResponder = @"TUITextRendererDidRes
 	if(attributedString) {
 		CGContextSaveGState(context);
 		
-		if(_flags.preDrawBlocksEnabled && !_flags.drawMaskDragSelection) {
-			[self.drawingAttributedString enumerateAttribute:TUIAttributedStringPreDrawBlockName inRange:NSMakeRange(0, [self.drawingAttributedString length]) options:0 usingBlock:^(id value, NSRange range, BOOL *stop) {
-				if(value == NULL) return;
-				
-				CGContextSaveGState(context);
-				
-				AB_CTLineRectAggregationType aggregationType = (AB_CTLineRectAggregationType) [[self.drawingAttributedString attribute:TUIAttributedStringBackgroundFillStyleName atIndex:range.location effectiveRange:NULL] integerValue];
-				NSArray *rectsArray = [self rectsForCharacterRange:CFRangeMake(range.location, range.length) aggregationType:aggregationType];
-				
-				CFIndex rectCount = rectsArray.count;
-				CGRect rects[rectCount];
-				for(NSUInteger i = 0; i < rectCount; i++) {
-					rects[i] = [[rectsArray objectAtIndex:i] rectValue];
+		if((_flags.preDrawBlocksEnabled || _flags.backgroundDrawingEnabled) && !_flags.drawMaskDragSelection) {
+			NSArray *decorations = [self _decorations];
+			
+			if(_flags.preDrawBlocksEnabled) {
+				// blocks may write to the rects they're given, so they get a scratch copy rather than the kept ones
+				CFIndex scratchCount = 1;
+				for(TUITextDecoration *decoration in decorations) {
+					if(!decoration->isBackground)
+						scratchCount = MAX(scratchCount, decoration->rectCount);
 				}
+				CGRect *scratchRects = malloc(sizeof(CGRect) * scratchCount);
 				
-				TUIAttributedStringPreDrawBlock block = value;
-				block(self.drawingAttributedString, range, rects, rectCount);
+				for(TUITextDecoration *decoration in decorations) {
+					if(decoration->isBackground) continue;
 					
-				CGContextRestoreGState(context);
-			}];
-		}
-		
-		if(_flags.backgroundDrawingEnabled && !_flags.drawMaskDragSelection) {
-			CGContextSaveGState(context);
-			
-			[self.drawingAttributedString enumerateAttribute:TUIAttributedStringBackgroundColorAttributeName inRange:NSMakeRange(0, [self.drawingAttributedString length]) options:0 usingBlock:^(id value, NSRange range, BOOL *stop) {
-				if(value == NULL) return;
-				
-				CGColorRef color = (__bridge CGColorRef) value;
-				CGContextSetFillColorWithColor(context, color);
+					if(decoration->rectCount > 0)
+						memcpy(scratchRects, decoration->rects, sizeof(CGRect) * decoration->rectCount);
+					
+					CGContextSaveGState(context);
+					TUIAttributedStringPreDrawBlock block = decoration->value;
+					block(self.drawingAttributedString, decoration->range, scratchRects, decoration->rectCount);
+					CGContextRestoreGState(context);
+				}
 				
-				AB_CTLineRectAggregationType aggregationType = (AB_CTLineRectAggregationType) [[self.drawingAttributedString attribute:TUIAttributedStringBackgroundFillStyleName atIndex:range.location effectiveRange:NULL] integerValue];
-				NSArray *rectsArray = [self rectsForCharacterRange:CFRangeMake(range.location, range.length) aggregationType:aggregationType];
+				free(scratchRects);
+			}
+			
+			if(_flags.backgroundDrawingEnabled) {
+				CGContextSaveGState(context);
 				
-				CFIndex rectCount = rectsArray.count;
-				CGRect rects[rectCount];
-				for(NSUInteger i = 0; i < rectCount; i++) {
-					rects[i] = [[rectsArray objectAtIndex:i] rectValue];
+				for(TUITextDecoration *decoration in decorations) {
+					if(!decoration->isBackground) continue;
+					
+					CGContextSetFillColorWithColor(context, (__bridge CGColorRef)decoration->value);
+					for(CFIndex i = 0; i < decoration->rectCount; ++i) {
+						CGRect r = CGRectInset(decoration->rects[i], -2, -1);
+						r = CGRectIntegral(r);
+						if(r.size.width > 1)
+							CGContextFillRect(context, r);
+					}
 				}
 				
-				for(CFIndex i = 0; i < rectCount; ++i) {
-					CGRect r = rects[i];
-					r = CGRectInset(r, -2, -1);
-					r = CGRectIntegral(r);
-					if(r.size.width > 1)
-						CGContextFillRect(context, r);
-				}
-			}];
-			
-			CGContextRestoreGState(context);
+				CGContextRestoreGState(context);
+			}
 		}
 		
 		CTFrameRef f = [self ctFrame];
@@ -291,20 +540,16 @@ NSString *const TUITextRendererDidResignFirstResponder = @"TUITextRendererDidRes
 			
 			NSRange _r = [hitRange rangeValue];
 			CFRange r = {_r.location, _r.length};
-			CFIndex nRects = 10;
-			CGRect rects[nRects];
-			AB_CTFrameGetRectsForRange(f, r, rects, &nRects);
-			for(int i = 0; i < nRects; ++i) {
-				CGRect rect = rects[i];
+			NSColor *color = [NSColor colorWithCalibratedWhite:1.0 alpha:1.0];
+			[color setFill];
+			CGContextSetShadowWithColor(context, CGSizeMake(0, 0), 8, color.tui_CGColor);
+			
+			AB_CTFrameMetricsEnumerateRectsForRange([self ctFrameMetrics], r, AB_CTLineRectAggregationTypeInline, ^(CGRect rect, BOOL *stop) {
 				rect = CGRectInset(rect, -2, -1);
 				rect.size.height -= 1;
 				rect = CGRectIntegral(rect);
-				NSColor *color = [NSColor colorWithCalibratedWhite:1.0 alpha:1.0];
-				[color setFill];
-
-				CGContextSetShadowWithColor(context, CGSizeMake(0, 0), 8, color.tui_CGColor);
 				CGContextFillRoundRect(context, rect, 10);
-			}
+			});
 			
 			CGContextRestoreGState(context);
 		}
@@ -314,9 +559,8 @@ NSString *const TUITextRendererDidResignFirstResponder = @"TUITextRendererDidRes
 			[self.selectionColor set];
 			
 			// draw (or mask) selection
-			CFIndex rectCount = 100;
-			CGRect rects[rectCount];
-			AB_CTFrameGetRectsForRange(f, selectedRange, rects, &rectCount);
+			CFIndex rectCount;
+			CGRect *rects = [self _selectionRectsForRange:selectedRange count:&rectCount];
 			if(_flags.drawMaskDragSelection) {
 				CGContextClipToRects(context, rects, rectCount);
 			} else {
@@ -328,6 +572,7 @@ NSString *const TUITextRendererDidResignFirstResponder = @"TUITextRendererDidRes
 			CGContextSetShadowWithColor(context, shadowOffset, shadowBlur, shadowColor.tui_CGColor);
 		
 		CGContextSetTextMatrix(context, CGAffineTransformIdentity);
+		CGContextTranslateCTM(context, _layoutOrigin.x, _layoutOrigin.y);
 		CTFrameDraw(f, context);
 		CGContextRestoreGState(context);
 	}
@@ -354,14 +599,8 @@ NSString *const TUITextRendererDidResignFirstResponder = @"TUITextRendererDidRes
 - (CGSize)sizeConstrainedToWidth:(CGFloat)width
 {
 	if(attributedString) {
-		CGRect oldFrame = frame;
-		self.frame = CGRectMake(0.0f, 0.0f, width, 1000000.0f);
-
-		CGSize size = [self size];
-		
-		self.frame = oldFrame;
-		
-		return size;
+		// measured through the layout cache without touching our own frame
+		return [TUITextRenderer sizeOfAttributedString:self.drawingAttributedString constrainedToSize:CGSizeMake(width, 1000000.0f)];
 	}
 	return CGSizeZero;
 }
@@ -398,7 +637,7 @@ NSString *const TUITextRendererDidResignFirstResponder = @"TUITextRendererDidRes
 {
 	CFIndex rectCount = 1;
 	CGRect rects[rectCount];
-	AB_CTFrameGetRectsForRange([self ctFrame], range, rects, &rectCount);
+	AB_CTFrameMetricsGetRectsForRange([self ctFrameMetrics], range, AB_CTLineRectAggregationTypeInline, rects, &rectCount);
 	if(rectCount > 0) {
 		return rects[0];
 	}
@@ -419,14 +658,10 @@ NSString *const TUITextRendererDidResignFirstResponder = @"TUITextRendererDidRes
 	NSValue *cacheKey = [NSValue valueWithRange:NSMakeRange(range.location, range.length)];
 	NSArray *cachedRects = [self.lineRects objectForKey:cacheKey];
 	if(cachedRects == nil) {
-		CFIndex rectCount = 100;
-		CGRect rects[rectCount];
-		AB_CTFrameGetRectsForRangeWithAggregationType([self ctFrame], range, aggregationType, rects, &rectCount);
-		
-		NSMutableArray *wrappedRects = [NSMutableArray arrayWithCapacity:rectCount];
-		for(CFIndex i = 0; i < rectCount; i++) {
-			[wrappedRects addObject:[NSValue valueWithRect:rects[i]]];
-		}
+		NSMutableArray *wrappedRects = [NSMutableArray array];
+		AB_CTFrameMetricsEnumerateRectsForRange([self ctFrameMetrics], range, aggregationType, ^(CGRect rect, BOOL *stop) {
+			[wrappedRects addObject:[NSValue valueWithRect:rect]];
+		});
 		
 		[self.lineRects setObject:wrappedRects forKey:cacheKey];
 		cachedRects = wrappedRects;
@@ -99,7 +99,8 @@
 		}
 		
 		NSArray *s = [self sortedSubviews];
-		for(TUIView *v in [s reverseObjectEnumerator]) {
+		for(NSUInteger i = [s count]; i > 0; --i) {
+			TUIView *v = [s objectAtIndex:i - 1];
 			TUIView *hit = [v accessibilityHitTest:[self convertPoint:point toView:v]];
 			if(hit)
 				return hit;
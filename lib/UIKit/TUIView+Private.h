@@ -27,7 +27,21 @@ typedef void (^TUIMouseDraggedHandler)(NSEvent *dragEvent);
 
 - (TUITextRenderer *)textRendererAtPoint:(CGPoint)point;
 - (void)_updateLayerScaleFactor;
+- (void)_releaseCGContexts; // for subclasses that stop drawing and set the layer's contents themselves
 
 @end
 
 extern CGFloat TUICurrentContextScaleFactor(void);
+
+typedef void (*TUIViewDrawRectIMP)(id, SEL, CGRect);
+
+/*
+ * What -displayLayer: needs to know about a class, looked up once per class
+ * rather than on every display.
+ */
+typedef struct {
+	TUIViewDrawRectIMP drawRectIMP; // NULL if drawRect: isn't overridden
+	BOOL overridesDisableDrawRect;
+} TUIViewRenderingTraits;
+
+extern const TUIViewRenderingTraits *TUIViewRenderingTraitsForClass(Class c);
@@ -100,8 +100,14 @@ extern CGRect(^TUIViewCenteredLayout)(TUIView*);
 		NSInteger lastWidth;
 		NSInteger lastHeight;
 		BOOL lastOpaque;
-		CGContextRef context;
-		CGRect dirtyRect;
+		CGContextRef context; // drawn into next
+		CGContextRef frontContext; // backs the layer's current contents
+		BOOL contextInUse; // context's last image may still be on screen
+		NSUInteger swapCount;
+		CGRect dirtyRects[8]; // merged together once full
+		NSUInteger dirtyRectCount;
+		BOOL needsFullDisplay;
+		CGRect frontOnlyRect; // drawn into frontContext but not yet into context
 		CGFloat lastContentsScale;
 	} _context;
 	
@@ -131,6 +137,12 @@ extern CGRect(^TUIViewCenteredLayout)(TUIView*);
 	TUIAccessibilityTraits accessibilityTraits;
 	CGRect accessibilityFrame;
 	NSOperationQueue *drawQueue;
+	NSOperation *_displayOperation;
+	NSUInteger _displayGeneration;
+	
+	NSArray *_sortedSubviews;
+	CGFloat *_sortedSubviewZPositions;
+	id _subviewIndex; // see indexesSubviews
 }
 
 /**
@@ -188,7 +200,7 @@ extern CGRect(^TUIViewCenteredLayout)(TUIView*);
 @property (nonatomic, assign) TUIViewContentMode contentMode;
 
 /**
- If YES, drawing will be done in a background queue. If `drawQueue` is nil, it will be performed in the DISPATCH_QUEUE_PRIORITY_DEFAULT global queue. Note that `-viewWillDisplayLayer:` will still be called on the main thread.
+ If YES, drawing will be done in a background queue into a private bitmap. The current contents stay on screen until the new bitmap is ready, and renders which are superseded by a newer one (or cancelled with -cancelBackgroundDrawing) are never shown. If `drawQueue` is nil, a shared queue running one render per core is used, with views in a window rendered first. Note that `-viewWillDisplayLayer:` will still be called on the main thread.
  
  Defaults to NO.
  */
@@ -251,6 +263,20 @@ extern CGRect(^TUIViewCenteredLayout)(TUIView*);
  */
 - (TUIView *)hitTest:(CGPoint)point withEvent:(id)event;
 
+/**
+ Returns the subviews whose frames intersect rect, in back to front order. rect is in the receiver's coordinate space.
+ */
+- (NSArray *)subviewsIntersectingRect:(CGRect)rect;
+
+/**
+ If YES, the frames of the subviews are kept in a spatial index, so -hitTest:withEvent: and -subviewsIntersectingRect: only look at the subviews near the point or rect instead of all of them. Worth turning on for views with hundreds of direct subviews.
+ 
+ With the index on, a subview is only hit tested for points inside its frame, so subviews which override -pointInside:withEvent: to respond outside of their frame won't see those points.
+ 
+ Defaults to NO.
+ */
+@property (nonatomic, assign) BOOL indexesSubviews;
+
 /**
  Default returns YES if point is in bounds (event ignored)
  */
@@ -272,6 +298,11 @@ extern CGRect(^TUIViewCenteredLayout)(TUIView*);
 - (CGSize)sizeThatFits:(CGSize)size;
 - (void)sizeToFit;                       // calls sizeThatFits: with current view bounds and changes bounds size.
 
+/**
+ The subviews in back to front order: by layer zPosition, then by their order in subviews.
+ 
+ The result is cached until a subview is added or removed, or a subview's zPosition changes.
+ */
 - (NSArray *)sortedSubviews;
 
 @end
@@ -359,6 +390,11 @@ extern CGRect(^TUIViewCenteredLayout)(TUIView*);
 - (void)setNeedsDisplay;
 - (void)setNeedsDisplayInRect:(CGRect)rect;
 
+/**
+ Drops a pending background render (see drawInBackground), so its result is never shown.
+ */
+- (void)cancelBackgroundDrawing;
+
 /**
  Recursive -setNeedsDisplay
  */
@@ -14,6 +14,7 @@
  limitations under the License.
  */
 
+#import <objc/runtime.h>
 #import <pthread.h>
 #import "NSColor+TUIExtensions.h"
 #import "TUICGAdditions.h"
@@ -69,6 +70,269 @@ CGRect(^TUIViewCenteredLayout)(TUIView*) = nil;
 @end
 
 
+#define MAXIMUM_DIRTY_RECTS (sizeof(_context.dirtyRects) / sizeof(_context.dirtyRects[0]))
+
+#define SUBVIEW_INDEX_CELL_SIZE 128.0f
+#define SUBVIEW_INDEX_MAXIMUM_CELLS_PER_VIEW 1024
+
+/*
+ * Where a subview sits in a TUIViewSubviewIndex: the cells its frame covers
+ * and its position in the superview's subviews.
+ */
+@interface TUIViewSubviewIndexEntry : NSObject
+{
+	@public
+	NSInteger minX, minY, maxX, maxY;
+	BOOL oversized; // covers too many cells to bucket, checked on every query
+	NSUInteger position;
+}
+@end
+
+@implementation TUIViewSubviewIndexEntry
+@end
+
+/*
+ * A uniform grid over the frames of a view's subviews. Each subview is
+ * bucketed into every cell its frame overlaps, so a point or rect query only
+ * needs to look at the subviews in the cells it touches.
+ */
+@interface TUIViewSubviewIndex : NSObject
+{
+	__unsafe_unretained TUIView *_view; // weak
+	NSMutableDictionary *_cells;        // packed cell coordinates -> NSMutableArray of subviews
+	NSMapTable *_entries;               // subview -> TUIViewSubviewIndexEntry
+	NSMutableArray *_oversizedSubviews;
+	NSInteger _minX, _minY, _maxX, _maxY; // cells that may be populated, valid while there are any
+	BOOL _positionsNeedUpdate;
+}
+
+- (id)initWithView:(TUIView *)view;
+- (void)updateSubview:(TUIView *)subview;
+- (void)removeSubview:(TUIView *)subview;
+- (void)subviewsDidChange;
+- (NSArray *)subviewsIntersectingRect:(CGRect)rect;
+- (NSArray *)subviewsContainingPoint:(CGPoint)point;
+
+@end
+
+static inline NSNumber *TUIViewSubviewIndexKey(NSInteger x, NSInteger y)
+{
+	return [NSNumber numberWithUnsignedLongLong:((uint64_t)(uint32_t)y << 32) | (uint32_t)x];
+}
+
+/*
+ * Cell coordinates are clamped to 32 bits, so frames further out than that
+ * share the outermost cells.
+ */
+static inline NSInteger TUIViewSubviewIndexCell(CGFloat v)
+{
+	CGFloat cell = floor(v / SUBVIEW_INDEX_CELL_SIZE);
+	if(isnan(cell))
+		return 0;
+	return (NSInteger)MAX(MIN(cell, (CGFloat)INT32_MAX), (CGFloat)INT32_MIN);
+}
+
+@implementation TUIViewSubviewIndex
+
+- (id)initWithView:(TUIView *)view
+{
+	if((self = [super init])) {
+		_view = view;
+		_cells = [[NSMutableDictionary alloc] init];
+		_entries = [NSMapTable mapTableWithKeyOptions:NSPointerFunctionsStrongMemory | NSPointerFunctionsObjectPointerPersonality
+										 valueOptions:NSPointerFunctionsStrongMemory];
+		_oversizedSubviews = [[NSMutableArray alloc] init];
+		_positionsNeedUpdate = YES;
+		
+		for(TUIView *subview in view.subviews)
+			[self updateSubview:subview];
+	}
+	return self;
+}
+
+- (void)_enumerateCellsOfEntry:(TUIViewSubviewIndexEntry *)entry usingBlock:(void (^)(NSNumber *key))block
+{
+	for(NSInteger y = entry->minY; y <= entry->maxY; ++y) {
+		for(NSInteger x = entry->minX; x <= entry->maxX; ++x) {
+			block(TUIViewSubviewIndexKey(x, y));
+		}
+	}
+}
+
+- (void)_unbucketSubview:(TUIView *)subview entry:(TUIViewSubviewIndexEntry *)entry
+{
+	if(entry->oversized) {
+		[_oversizedSubviews removeObjectIdenticalTo:subview];
+		return;
+	}
+	
+	[self _enumerateCellsOfEntry:entry usingBlock:^(NSNumber *key) {
+		NSMutableArray *cell = [_cells objectForKey:key];
+		[cell removeObjectIdenticalTo:subview];
+		if([cell count] == 0)
+			[_cells removeObjectForKey:key];
+	}];
+}
+
+- (void)updateSubview:(TUIView *)subview
+{
+	CGRect frame = subview.frame;
+	TUIViewSubviewIndexEntry *entry = [_entries objectForKey:subview];
+	
+	NSInteger minX = TUIViewSubviewIndexCell(CGRectGetMinX(frame));
+	NSInteger minY = TUIViewSubviewIndexCell(CGRectGetMinY(frame));
+	NSInteger maxX = TUIViewSubviewIndexCell(CGRectGetMaxX(frame));
+	NSInteger maxY = TUIViewSubviewIndexCell(CGRectGetMaxY(frame));
+	BOOL oversized = CGRectIsNull(frame) || CGRectIsInfinite(frame) ||
+		(CGRectGetWidth(frame) / SUBVIEW_INDEX_CELL_SIZE + 1) * (CGRectGetHeight(frame) / SUBVIEW_INDEX_CELL_SIZE + 1) > SUBVIEW_INDEX_MAXIMUM_CELLS_PER_VIEW;
+	
+	if(entry) {
+		if(entry->oversized == oversized && (oversized ||
+		   (entry->minX == minX && entry->minY == minY && entry->maxX == maxX && entry->maxY == maxY)))
+			return; // still in the same cells
+		[self _unbucketSubview:subview entry:entry];
+	} else {
+		entry = [[TUIViewSubviewIndexEntry alloc] init];
+		[_entries setObject:entry forKey:subview];
+		_positionsNeedUpdate = YES;
+	}
+	
+	entry->oversized = oversized;
+	if(oversized) {
+		[_oversizedSubviews addObject:subview];
+		return;
+	}
+	
+	entry->minX = minX;
+	entry->minY = minY;
+	entry->maxX = maxX;
+	entry->maxY = maxY;
+	if([_cells count] == 0) {
+		_minX = minX;
+		_minY = minY;
+		_maxX = maxX;
+		_maxY = maxY;
+	} else {
+		_minX = MIN(_minX, minX);
+		_minY = MIN(_minY, minY);
+		_maxX = MAX(_maxX, maxX);
+		_maxY = MAX(_maxY, maxY);
+	}
+	[self _enumerateCellsOfEntry:entry usingBlock:^(NSNumber *key) {
+		NSMutableArray *cell = [_cells objectForKey:key];
+		if(!cell) {
+			cell = [[NSMutableArray alloc] init];
+			[_cells setObject:cell forKey:key];
+		}
+		[cell addObject:subview];
+	}];
+}
+
+- (void)removeSubview:(TUIView *)subview
+{
+	TUIViewSubviewIndexEntry *entry = [_entries objectForKey:subview];
+	if(!entry)
+		return;
+	
+	[self _unbucketSubview:subview entry:entry];
+	[_entries removeObjectForKey:subview];
+	_positionsNeedUpdate = YES;
+}
+
+- (void)subviewsDidChange
+{
+	_positionsNeedUpdate = YES;
+}
+
+/*
+ * Sorts the given subviews back to front, the same way -sortedSubviews does.
+ */
+- (NSArray *)_sortedSubviews:(NSArray *)subviews
+{
+	if(_positionsNeedUpdate) {
+		NSUInteger position = 0;
+		for(TUIView *subview in _view.subviews) {
+			TUIViewSubviewIndexEntry *entry = [_entries objectForKey:subview];
+			if(entry)
+				entry->position = position;
+			position++;
+		}
+		_positionsNeedUpdate = NO;
+	}
+	
+	return [subviews sortedArrayUsingComparator:(NSComparator)^NSComparisonResult(TUIView *a, TUIView *b) {
+		CGFloat x = a.layer.zPosition;
+		CGFloat y = b.layer.zPosition;
+		if(x > y)
+			return NSOrderedDescending;
+		else if(x < y)
+			return NSOrderedAscending;
+		
+		NSUInteger i = ((TUIViewSubviewIndexEntry *)[_entries objectForKey:a])->position;
+		NSUInteger j = ((TUIViewSubviewIndexEntry *)[_entries objectForKey:b])->position;
+		if(i > j)
+			return NSOrderedDescending;
+		else if(i < j)
+			return NSOrderedAscending;
+		return NSOrderedSame;
+	}];
+}
+
+- (NSArray *)subviewsIntersectingRect:(CGRect)rect
+{
+	if(CGRectIsNull(rect))
+		return [NSArray array];
+	
+	NSMutableSet *candidates = [NSMutableSet setWithArray:_oversizedSubviews];
+	
+	// only look at the cells that may be populated
+	NSInteger minX = MAX(TUIViewSubviewIndexCell(CGRectGetMinX(rect)), _minX);
+	NSInteger minY = MAX(TUIViewSubviewIndexCell(CGRectGetMinY(rect)), _minY);
+	NSInteger maxX = MIN(TUIViewSubviewIndexCell(CGRectGetMaxX(rect)), _maxX);
+	NSInteger maxY = MIN(TUIViewSubviewIndexCell(CGRectGetMaxY(rect)), _maxY);
+	
+	if([_cells count] == 0 || minX > maxX || minY > maxY) {
+		// nothing but the oversized subviews
+	} else if((double)(maxX - minX + 1) * (double)(maxY - minY + 1) > (double)[_cells count]) {
+		// a rect bigger than the populated area; walking the cells is cheaper
+		for(NSMutableArray *cell in [_cells objectEnumerator])
+			[candidates addObjectsFromArray:cell];
+	} else {
+		for(NSInteger y = minY; y <= maxY; ++y) {
+			for(NSInteger x = minX; x <= maxX; ++x) {
+				NSArray *cell = [_cells objectForKey:TUIViewSubviewIndexKey(x, y)];
+				if(cell)
+					[candidates addObjectsFromArray:cell];
+			}
+		}
+	}
+	
+	NSMutableArray *subviews = [NSMutableArray arrayWithCapacity:[candidates count]];
+	for(TUIView *subview in candidates) {
+		if(CGRectIntersectsRect(subview.frame, rect))
+			[subviews addObject:subview];
+	}
+	return [self _sortedSubviews:subviews];
+}
+
+- (NSArray *)subviewsContainingPoint:(CGPoint)point
+{
+	NSMutableArray *subviews = [NSMutableArray array];
+	NSArray *cell = [_cells objectForKey:TUIViewSubviewIndexKey(TUIViewSubviewIndexCell(point.x), TUIViewSubviewIndexCell(point.y))];
+	
+	for(TUIView *subview in cell) {
+		if(CGRectContainsPoint(subview.frame, point))
+			[subviews addObject:subview];
+	}
+	for(TUIView *subview in _oversizedSubviews) {
+		if(CGRectContainsPoint(subview.frame, point))
+			[subviews addObject:subview];
+	}
+	return [self _sortedSubviews:subviews];
+}
+
+@end
+
 @interface TUIView ()
 @property (nonatomic, strong) NSMutableArray *subviews;
 
@@ -78,6 +342,18 @@ CGRect(^TUIViewCenteredLayout)(TUIView*) = nil;
  * layer.
  */
 - (void)prepareSubview:(TUIView *)view insertionBlock:(void (^)(void))block;
+
+/*
+ * Drops the cached -sortedSubviews. Called whenever a subview is added or
+ * removed.
+ */
+- (void)_invalidateSortedSubviews;
+
+/*
+ * Tells the superview's subview index, if it has one, that the receiver's
+ * frame may have changed.
+ */
+- (void)_updateFrameInSuperviewIndex;
 @end
 
 @implementation TUIView
@@ -136,10 +412,9 @@ static pthread_key_t TUICurrentContextScaleFactorTLSKey;
     
 	[self setTextRenderers:nil];
 	_layer.delegate = nil;
-	if(_context.context) {
-		CGContextRelease(_context.context);
-		_context.context = NULL;
-	}
+	free(_sortedSubviewZPositions);
+	CGContextRelease(_context.context);
+	CGContextRelease(_context.frontContext);
 }
 
 - (id)initWithFrame:(CGRect)frame
@@ -284,7 +559,7 @@ static pthread_key_t TUICurrentContextScaleFactorTLSKey;
 	BOOL o = self.opaque;
 	CGFloat currentScale = [self.layer respondsToSelector:@selector(contentsScale)] ? self.layer.contentsScale : 1.0f;
 	
-	if(_context.context) {
+	if(_context.context || _context.frontContext) {
 		// kill if we're a different size
 		if(w != _context.lastWidth || 
 		   h != _context.lastHeight ||
@@ -292,10 +567,20 @@ static pthread_key_t TUICurrentContextScaleFactorTLSKey;
 		   fabs(currentScale - _context.lastContentsScale) > 0.1f) 
 		{
 			CGContextRelease(_context.context);
+			CGContextRelease(_context.frontContext);
 			_context.context = NULL;
+			_context.frontContext = NULL;
 		}
 	}
 	
+	// Core Animation may still show the last image drawn in here (as the old
+	// contents of a crossfade, say), and drawing over it would show up there.
+	// Leave the bitmap to the image and draw into a new one.
+	if(_context.context && _context.contextInUse) {
+		CGContextRelease(_context.context);
+		_context.context = NULL;
+	}
+	
 	if(!_context.context) {
 		// create a new context with the correct parameters
 		_context.lastWidth = w;
@@ -307,13 +592,91 @@ static pthread_key_t TUICurrentContextScaleFactorTLSKey;
 		b.size.height *= currentScale;
 		if(b.size.width < 1) b.size.width = 1;
 		if(b.size.height < 1) b.size.height = 1;
-		CGContextRef ctx = TUICreateGraphicsContextWithOptions(b.size, o);
+		CGContextRef ctx = TUICreatePooledGraphicsContextWithOptions(b.size, o);
 		_context.context = ctx;
+		_context.contextInUse = NO;
+		
+		// none of what's on screen has been drawn in here yet
+		if(_context.frontContext)
+			_context.frontOnlyRect = self.bounds;
 	}
 	
 	return _context.context;
 }
 
+/*
+ * The layer's contents share memory with the context they were drawn in (see
+ * -displayLayer:), so drawing alternates between two contexts. This hands the
+ * one just drawn in over to the layer as its contents and returns the other
+ * one to drawing.
+ *
+ * The old contents may stay on screen until the animations of that change are
+ * done, so the context returned to drawing isn't drawn in again until then:
+ * the change is made in a transaction of its own, whose completion frees the
+ * context unless it's been swapped again since.
+ */
+- (void)_swapCGContextsShowingImage:(CGImageRef)image inLayer:(CALayer *)layer
+{
+	CGContextRef drawn = _context.context;
+	_context.context = _context.frontContext;
+	_context.frontContext = drawn;
+	
+	_context.contextInUse = (_context.context != NULL);
+	NSUInteger swapCount = ++_context.swapCount;
+	__weak TUIView *weakSelf = self;
+	
+	[CATransaction begin];
+	[CATransaction setCompletionBlock:^{
+		TUIView *view = weakSelf;
+		if(view && view->_context.swapCount == swapCount)
+			view->_context.contextInUse = NO;
+	}];
+	layer.contents = (__bridge id)image;
+	[CATransaction commit];
+}
+
+- (void)_releaseCGContexts
+{
+	CGContextRelease(_context.context);
+	CGContextRelease(_context.frontContext);
+	_context.context = NULL;
+	_context.frontContext = NULL;
+	_context.contextInUse = NO;
+}
+
+/*
+ * Brings the given rect of the context about to be drawn in up to date with
+ * what's on screen. Only the rect drawn by the previous draw can differ, so a
+ * partial draw copies that instead of the whole bitmap.
+ */
+- (void)_copyRect:(CGRect)rect fromFrontCGContextIntoContext:(CGContextRef)context scale:(CGFloat)scale
+{
+	CGContextRef front = _context.frontContext;
+	size_t width = CGBitmapContextGetWidth(context);
+	size_t height = CGBitmapContextGetHeight(context);
+	size_t bytesPerRow = CGBitmapContextGetBytesPerRow(context);
+	if(!front || CGBitmapContextGetWidth(front) != width || CGBitmapContextGetHeight(front) != height ||
+	   CGBitmapContextGetBytesPerRow(front) != bytesPerRow)
+		return;
+	
+	CGRect pixels = CGRectMake(rect.origin.x * scale, rect.origin.y * scale, rect.size.width * scale, rect.size.height * scale);
+	pixels = CGRectIntersection(CGRectIntegral(pixels), CGRectMake(0, 0, width, height));
+	if(CGRectIsEmpty(pixels))
+		return;
+	
+	// bitmap rows run top to bottom, the context's y axis bottom to top
+	size_t bytesPerPixel = CGBitmapContextGetBitsPerPixel(context) / 8;
+	size_t offset = (height - (size_t)CGRectGetMaxY(pixels)) * bytesPerRow + (size_t)CGRectGetMinX(pixels) * bytesPerPixel;
+	size_t rowLength = (size_t)CGRectGetWidth(pixels) * bytesPerPixel;
+	unsigned char *src = (unsigned char *)CGBitmapContextGetData(front) + offset;
+	unsigned char *dst = (unsigned char *)CGBitmapContextGetData(context) + offset;
+	for(size_t row = 0; row < (size_t)CGRectGetHeight(pixels); ++row) {
+		memcpy(dst, src, rowLength);
+		src += bytesPerRow;
+		dst += bytesPerRow;
+	}
+}
+
 CGFloat TUICurrentContextScaleFactor(void)
 {
 	/*
@@ -336,35 +699,83 @@ static void TUISetCurrentContextScaleFactor(CGFloat s)
 	*v = s;
 }
 
+const TUIViewRenderingTraits *TUIViewRenderingTraitsForClass(Class c)
+{
+	static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+	static CFMutableDictionaryRef traitsByClass = NULL;
+	
+	pthread_mutex_lock(&lock);
+	if(!traitsByClass)
+		traitsByClass = CFDictionaryCreateMutable(NULL, 0, NULL, NULL);
+	
+	TUIViewRenderingTraits *traits = (TUIViewRenderingTraits *)CFDictionaryGetValue(traitsByClass, (__bridge const void *)c);
+	if(!traits) {
+		// classes are never unloaded, so neither are their traits
+		traits = malloc(sizeof(TUIViewRenderingTraits));
+		
+		TUIViewDrawRectIMP drawRectIMP = (TUIViewDrawRectIMP)[c instanceMethodForSelector:@selector(drawRect:)];
+		TUIViewDrawRectIMP basicDrawRectIMP = (TUIViewDrawRectIMP)[TUIView instanceMethodForSelector:@selector(drawRect:)];
+		traits->drawRectIMP = (drawRectIMP != basicDrawRectIMP) ? drawRectIMP : NULL;
+		traits->overridesDisableDrawRect = [c instanceMethodForSelector:@selector(_disableDrawRect)] != [TUIView instanceMethodForSelector:@selector(_disableDrawRect)];
+		
+		CFDictionarySetValue(traitsByClass, (__bridge const void *)c, traits);
+	}
+	pthread_mutex_unlock(&lock);
+	
+	return traits;
+}
+
 - (void)displayLayer:(CALayer *)layer
 {
-	typedef void (*DrawRectIMP)(id,SEL,CGRect);
+	const TUIViewRenderingTraits *traits = TUIViewRenderingTraitsForClass(object_getClass(self));
 	SEL drawRectSEL = @selector(drawRect:);
-	DrawRectIMP drawRectIMP = (DrawRectIMP)[self methodForSelector:drawRectSEL];
-	DrawRectIMP dontCallThisBasicDrawRectIMP = (DrawRectIMP)[TUIView instanceMethodForSelector:drawRectSEL];
+	TUIViewDrawRectIMP drawRectIMP = traits->drawRectIMP;
+	BOOL drawRectDisabled = traits->overridesDisableDrawRect && [self _disableDrawRect];
 
-	if (!self.drawRect && (drawRectIMP == dontCallThisBasicDrawRectIMP || [self _disableDrawRect])) {
+	if (!self.drawRect && (drawRectIMP == NULL || drawRectDisabled)) {
 		// drawRect isn't overridden by subclass, don't call, let the CA machinery just handle backgroundColor (fast path)
 		return;
 	}
 
+	if (self.drawInBackground) {
+		[self _displayLayerInBackground:layer drawRectIMP:drawRectIMP];
+		return;
+	}
+
 	void (^drawBlock)(void) = ^{
 		if (_viewFlags.delegateWillDisplayLayer) {
 			[_viewDelegate viewWillDisplayLayer:self];
 		}
 
-		CGRect rectToDraw = self.bounds;
-		if (!CGRectEqualToRect(_context.dirtyRect, CGRectZero)) {
-			rectToDraw = _context.dirtyRect;
-			_context.dirtyRect = CGRectZero;
+		CGRect bounds = self.bounds;
+		CGContextRef context = [self _CGContext];
+		CGFloat scale = [self.layer respondsToSelector:@selector(contentsScale)] ? self.layer.contentsScale : 1.0f;
+
+		// only redraw the dirty region when there's something on screen to keep
+		BOOL drawsDirtyRegion = !_context.needsFullDisplay && _context.dirtyRectCount > 0 && _context.frontContext != NULL;
+		CGRect rectToDraw = bounds;
+		if (drawsDirtyRegion) {
+			rectToDraw = CGRectNull;
+			for (NSUInteger i = 0; i < _context.dirtyRectCount; ++i) {
+				rectToDraw = CGRectUnion(rectToDraw, _context.dirtyRects[i]);
+			}
+		}
+		if (drawsDirtyRegion || !_viewFlags.clearsContextBeforeDrawing) {
+			// draws on top of what's on screen, so catch up with the last draw
+			[self _copyRect:_context.frontOnlyRect fromFrontCGContextIntoContext:context scale:scale];
 		}
 
-		CGContextRef context = [self _CGContext];
 		TUIGraphicsPushContext(context);
 
-		CGFloat scale = [self.layer respondsToSelector:@selector(contentsScale)] ? self.layer.contentsScale : 1.0f;
 		TUISetCurrentContextScaleFactor(scale);
 		CGContextScaleCTM(context, scale, scale);
+		CGContextSaveGState(context);
+
+		if (drawsDirtyRegion) {
+			CGContextClipToRects(context, _context.dirtyRects, _context.dirtyRectCount);
+		}
+		_context.dirtyRectCount = 0;
+		_context.needsFullDisplay = NO;
 
 		if (_viewFlags.clearsContextBeforeDrawing) {
 			CGContextClearRect(context, rectToDraw);
@@ -377,7 +788,7 @@ static void TUISetCurrentContextScaleFactor(CGFloat s)
 		if (self.drawRect) {
 			// drawRect is implemented via a block
 			self.drawRect(self, rectToDraw);
-		} else if ((drawRectIMP != dontCallThisBasicDrawRectIMP) && ![self _disableDrawRect]) {
+		} else if (drawRectIMP != NULL && !drawRectDisabled) {
 			// drawRect is overridden by subclass
 			drawRectIMP(self, drawRectSEL, rectToDraw);
 		}
@@ -391,22 +802,18 @@ static void TUISetCurrentContextScaleFactor(CGFloat s)
 		CGContextFillRect(context, rectToDraw);
 		#endif
 
-		layer.contents = TUIGraphicsGetImageFromCurrentImageContext();
+		CGContextRestoreGState(context);
 		CGContextScaleCTM(context, 1.0f / scale, 1.0f / scale);
 		TUIGraphicsPopContext();
+		_context.frontOnlyRect = rectToDraw;
 
-		if (self.drawInBackground) [CATransaction flush];
+		// hand the layer the bitmap itself rather than a copy of it
+		CGImageRef image = TUICreateCGImageSharingBitmapContext(context);
+		[self _swapCGContextsShowingImage:image inLayer:layer];
+		CGImageRelease(image);
 	};
 	
-	if (self.drawInBackground) {
-		layer.contents = nil;
-		
-		if (self.drawQueue != nil) {
-			[self.drawQueue addOperationWithBlock:drawBlock];
-		} else {
-			dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), drawBlock);
-		}
-	} else if ([NSThread isMainThread] || dispatch_get_current_queue() == dispatch_get_main_queue()) {
+	if ([NSThread isMainThread] || dispatch_get_current_queue() == dispatch_get_main_queue()) {
 		drawBlock();
 	} else {
 		// On Mac OS X 10.6 (and possibly other versions), spinning a run loop in
@@ -416,6 +823,102 @@ static void TUISetCurrentContextScaleFactor(CGFloat s)
 	}
 }
 
+/*
+ * The queue used for background drawing when a view has no drawQueue of its
+ * own. It runs as many renders at once as there are cores.
+ */
++ (NSOperationQueue *)_sharedDrawQueue
+{
+	static NSOperationQueue *sharedDrawQueue = nil;
+	static dispatch_once_t onceToken;
+	dispatch_once(&onceToken, ^{
+		sharedDrawQueue = [[NSOperationQueue alloc] init];
+		[sharedDrawQueue setMaxConcurrentOperationCount:[[NSProcessInfo processInfo] activeProcessorCount]];
+	});
+	return sharedDrawQueue;
+}
+
+/*
+ * Renders the view into a private bitmap on the draw queue. The layer keeps
+ * its current contents until the render is done, and a render that has been
+ * superseded by a newer one or cancelled with -cancelBackgroundDrawing is
+ * thrown away instead of being shown. Views in a window are rendered ahead of
+ * views which are not.
+ */
+- (void)_displayLayerInBackground:(CALayer *)layer drawRectIMP:(TUIViewDrawRectIMP)drawRectIMP
+{
+	if (_viewFlags.delegateWillDisplayLayer) {
+		[_viewDelegate viewWillDisplayLayer:self];
+	}
+	
+	[_displayOperation cancel];
+	NSUInteger generation = ++_displayGeneration;
+	
+	// background renders always cover the whole bounds
+	_context.dirtyRectCount = 0;
+	_context.needsFullDisplay = NO;
+	
+	CGRect bounds = self.bounds;
+	CGFloat scale = [layer respondsToSelector:@selector(contentsScale)] ? layer.contentsScale : 1.0f;
+	BOOL opaque = self.opaque;
+	BOOL clearsContext = _viewFlags.clearsContextBeforeDrawing;
+	BOOL smoothFonts = !_viewFlags.disableSubpixelTextRendering;
+	TUIViewDrawRect drawRectBlock = self.drawRect;
+	
+	NSBlockOperation *operation = [[NSBlockOperation alloc] init];
+	__weak NSBlockOperation *weakOperation = operation;
+	[operation addExecutionBlock:^{
+		// superseded renders are cancelled, the generation is only checked on the main thread
+		if ([weakOperation isCancelled])
+			return;
+		
+		CGSize size = CGSizeMake(MAX(bounds.size.width * scale, 1), MAX(bounds.size.height * scale, 1));
+		CGContextRef context = TUICreatePooledGraphicsContextWithOptions(size, opaque);
+		TUIGraphicsPushContext(context);
+		
+		TUISetCurrentContextScaleFactor(scale);
+		CGContextScaleCTM(context, scale, scale);
+		
+		if (clearsContext) {
+			CGContextClearRect(context, bounds);
+		}
+		
+		CGContextSetAllowsAntialiasing(context, true);
+		CGContextSetShouldAntialias(context, true);
+		CGContextSetShouldSmoothFonts(context, smoothFonts);
+		
+		if (drawRectBlock) {
+			drawRectBlock(self, bounds);
+		} else {
+			drawRectIMP(self, @selector(drawRect:), bounds);
+		}
+		
+		// the context is never drawn in again, so the image can share its memory
+		CGImageRef image = TUICreateCGImageSharingBitmapContext(context);
+		TUIGraphicsPopContext();
+		CGContextRelease(context);
+		
+		dispatch_async(dispatch_get_main_queue(), ^{
+			if (generation == _displayGeneration) {
+				layer.contents = (__bridge id)image;
+				_displayOperation = nil;
+			}
+			CGImageRelease(image);
+		});
+	}];
+	
+	operation.queuePriority = (_nsView != nil) ? NSOperationQueuePriorityHigh : NSOperationQueuePriorityNormal;
+	_displayOperation = operation;
+	[(self.drawQueue ?: [TUIView _sharedDrawQueue]) addOperation:operation];
+}
+
+- (void)cancelBackgroundDrawing
+{
+	[_displayOperation cancel];
+	_displayOperation = nil;
+	_displayGeneration++;
+}
+
 - (void)_blockLayout
 {
 	for(TUIView *v in self.subviews) {
@@ -580,6 +1083,8 @@ static void TUISetCurrentContextScaleFactor(CGFloat s)
 	view.nsView = _nsView;
 
 	block();
+	[self _invalidateSortedSubviews];
+	[_subviewIndex updateSubview:view];
 
 	[self didAddSubview:view];
 	[view didMoveToSuperview];
@@ -601,7 +1106,11 @@ static void TUISetCurrentContextScaleFactor(CGFloat s)
 
 - (void)setFrame:(CGRect)f
 {
+	CGRect oldBounds = self.bounds;
 	self.layer.frame = f;
+	if(!CGRectEqualToRect(self.bounds, oldBounds))
+		_context.needsFullDisplay = YES; // the layer redisplays itself for new bounds, see -layer
+	[self _updateFrameInSuperviewIndex];
 	[self.subviews makeObjectsPerformSelector:@selector(ancestorDidLayout)];
     [[NSNotificationCenter defaultCenter] postNotificationName:TUIViewFrameDidChangeNotification object:self];
 }
@@ -613,7 +1122,10 @@ static void TUISetCurrentContextScaleFactor(CGFloat s)
 
 - (void)setBounds:(CGRect)b
 {
+	if(!CGRectEqualToRect(b, self.bounds))
+		_context.needsFullDisplay = YES; // the layer redisplays itself for new bounds, see -layer
 	self.layer.bounds = b;
+	[self _updateFrameInSuperviewIndex];
 	[self.subviews makeObjectsPerformSelector:@selector(ancestorDidLayout)];
 }
 
@@ -640,19 +1152,67 @@ static void TUISetCurrentContextScaleFactor(CGFloat s)
 - (void)setTransform:(CGAffineTransform)t
 {
 	[self.layer setAffineTransform:t];
+	[self _updateFrameInSuperviewIndex];
+}
+
+- (void)_updateFrameInSuperviewIndex
+{
+	TUIView *superview = self.superview;
+	if(superview && superview->_subviewIndex)
+		[superview->_subviewIndex updateSubview:self];
+}
+
+- (BOOL)indexesSubviews
+{
+	return _subviewIndex != nil;
+}
+
+- (void)setIndexesSubviews:(BOOL)indexes
+{
+	if(indexes == [self indexesSubviews])
+		return;
+	_subviewIndex = indexes ? [[TUIViewSubviewIndex alloc] initWithView:self] : nil;
+}
+
+- (void)_invalidateSortedSubviews
+{
+	_sortedSubviews = nil;
+	[_subviewIndex subviewsDidChange];
 }
 
 - (NSArray *)sortedSubviews // back to front order
 {
-	return [self.subviews sortedArrayWithOptions:NSSortStable usingComparator:(NSComparator)^NSComparisonResult(TUIView *a, TUIView *b) {
-		CGFloat x = a.layer.zPosition;
-		CGFloat y = b.layer.zPosition;
-		if(x > y)
-			return NSOrderedDescending;
-		else if(x < y)
-			return NSOrderedAscending;
-		return NSOrderedSame;
-	}];
+	if(_sortedSubviews) {
+		// zPosition is set on the layers directly, so we can't observe it changing;
+		// compare against the values we sorted by instead
+		NSUInteger count = [_sortedSubviews count];
+		for(NSUInteger i = 0; i < count; ++i) {
+			TUIView *v = [_sortedSubviews objectAtIndex:i];
+			if(v.layer.zPosition != _sortedSubviewZPositions[i]) {
+				_sortedSubviews = nil;
+				break;
+			}
+		}
+	}
+	
+	if(!_sortedSubviews) {
+		_sortedSubviews = [self.subviews sortedArrayWithOptions:NSSortStable usingComparator:(NSComparator)^NSComparisonResult(TUIView *a, TUIView *b) {
+			CGFloat x = a.layer.zPosition;
+			CGFloat y = b.layer.zPosition;
+			if(x > y)
+				return NSOrderedDescending;
+			else if(x < y)
+				return NSOrderedAscending;
+			return NSOrderedSame;
+		}];
+		
+		NSUInteger count = [_sortedSubviews count];
+		_sortedSubviewZPositions = realloc(_sortedSubviewZPositions, MAX(count, 1) * sizeof(CGFloat));
+		for(NSUInteger i = 0; i < count; ++i)
+			_sortedSubviewZPositions[i] = ((TUIView *)[_sortedSubviews objectAtIndex:i]).layer.zPosition;
+	}
+	
+	return _sortedSubviews;
 }
 
 - (TUIView *)hitTest:(CGPoint)point withEvent:(id)event
@@ -661,8 +1221,9 @@ static void TUISetCurrentContextScaleFactor(CGFloat s)
 		return nil;
 	
 	if([self pointInside:point withEvent:event]) {
-		NSArray *s = [self sortedSubviews];
-		for(TUIView *v in [s reverseObjectEnumerator]) {
+		NSArray *s = _subviewIndex ? [_subviewIndex subviewsContainingPoint:point] : [self sortedSubviews];
+		for(NSUInteger i = [s count]; i > 0; --i) {
+			TUIView *v = [s objectAtIndex:i - 1];
 			TUIView *hit = [v hitTest:[self convertPoint:point toView:v] withEvent:event];
 			if(hit)
 				return hit;
@@ -672,6 +1233,19 @@ static void TUISetCurrentContextScaleFactor(CGFloat s)
 	return nil;
 }
 
+- (NSArray *)subviewsIntersectingRect:(CGRect)rect
+{
+	if(_subviewIndex)
+		return [_subviewIndex subviewsIntersectingRect:rect];
+	
+	NSMutableArray *subviews = [NSMutableArray array];
+	for(TUIView *v in [self sortedSubviews]) {
+		if(CGRectIntersectsRect(v.frame, rect))
+			[subviews addObject:v];
+	}
+	return subviews;
+}
+
 - (BOOL)pointInside:(CGPoint)point withEvent:(id)event
 {
 	return [self.layer containsPoint:point];
@@ -763,6 +1337,8 @@ static void TUISetCurrentContextScaleFactor(CGFloat s)
 		[self willMoveToSuperview:nil];
 
 		[superview.subviews removeObjectIdenticalTo:self];
+		[superview _invalidateSortedSubviews];
+		[superview->_subviewIndex removeSubview:self];
 		[self.layer removeFromSuperlayer];
 		self.nsView = nil;
 
@@ -1033,12 +1609,37 @@ static void TUISetCurrentContextScaleFactor(CGFloat s)
 
 - (void)setNeedsDisplay
 {
+	_context.needsFullDisplay = YES;
 	[self.layer setNeedsDisplay];
 }
 
 - (void)setNeedsDisplayInRect:(CGRect)rect
 {
-	_context.dirtyRect = rect;
+	rect = CGRectIntersection(rect, self.bounds);
+	if(CGRectIsEmpty(rect))
+		return;
+	
+	if(!_context.needsFullDisplay) {
+		// fold the rect in with any dirty rects it overlaps
+		NSUInteger i = 0;
+		while(i < _context.dirtyRectCount) {
+			if(CGRectIntersectsRect(_context.dirtyRects[i], rect)) {
+				rect = CGRectUnion(rect, _context.dirtyRects[i]);
+				_context.dirtyRects[i] = _context.dirtyRects[--_context.dirtyRectCount];
+				i = 0;
+			} else {
+				i++;
+			}
+		}
+		
+		if(_context.dirtyRectCount == MAXIMUM_DIRTY_RECTS) {
+			// out of room, merge into the last one
+			_context.dirtyRects[_context.dirtyRectCount - 1] = CGRectUnion(_context.dirtyRects[_context.dirtyRectCount - 1], rect);
+		} else {
+			_context.dirtyRects[_context.dirtyRectCount++] = rect;
+		}
+	}
+	
 	[self.layer setNeedsDisplayInRect:rect];
 }
 